@@ -0,0 +1,24 @@
+#pragma once
+#include "scebase.h"
+
+//[comment]
+// Linux stand-in for the few Gnm types the allocators use. No GPU work is done on Linux, so onion
+// and garlic memory are both plain CPU memory there.
+//[/comment]
+namespace sce
+{
+	namespace Gnm
+	{
+		typedef uint32_t AlignmentType;
+		static const AlignmentType kAlignmentOfBufferInBytes = 16;
+
+		typedef uint32_t OwnerHandle;
+		static const OwnerHandle kInvalidOwnerHandle = 0xFFFFFFFF;
+
+		struct SizeAlign
+		{
+			uint32_t m_size;
+			AlignmentType m_align;
+		};
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "gnm.h"
+
+//[comment]
+// Linux stand-in for the Gnmx header, only the namespace the ray tracer pulls in.
+//[/comment]
+namespace sce
+{
+	namespace Gnmx
+	{
+	}
+}
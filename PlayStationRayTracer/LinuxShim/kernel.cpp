@@ -0,0 +1,70 @@
+#include <sys/mman.h>
+#include <mutex>
+#include <algorithm>
+#include "kernel.h"
+#include "../../RayTracerFramework - best efficiency/RayTracerSmall/LinearAllocator.h"
+
+//[comment]
+// Pretend physical memory: the direct memory a PS4 title gets, handed out bump style from
+// s_nextOffset. Released ranges are only counted, not reused, which is plenty for a benchmark run.
+//[/comment]
+static const size_t kDirectMemorySize = 5UL * 1024 * 1024 * 1024;
+static std::mutex s_directMemoryMutex;
+static off_t s_nextOffset = 64 * 1024; //0 is never handed out, the allocators use it as "none"
+static size_t s_allocatedBytes = 0;
+
+size_t sceKernelGetDirectMemorySize()
+{
+	return kDirectMemorySize;
+}
+
+int32_t sceKernelAllocateDirectMemory(off_t searchStart, off_t searchEnd, size_t len, size_t alignment, int /*memoryType*/, off_t* physicalAddressDestination)
+{
+	if (len == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0 || physicalAddressDestination == nullptr) return SCE_KERNEL_ERROR_EINVAL;
+	std::lock_guard<std::mutex> lock(s_directMemoryMutex);
+	off_t start = (std::max(s_nextOffset, searchStart) + alignment - 1) & ~(off_t)(alignment - 1);
+	if (start + (off_t)len - 1 > searchEnd || s_allocatedBytes + len > kDirectMemorySize) return SCE_KERNEL_ERROR_ENOMEM;
+	s_nextOffset = start + len;
+	s_allocatedBytes += len;
+	*physicalAddressDestination = start;
+	return SCE_OK;
+}
+
+int32_t sceKernelReleaseDirectMemory(off_t /*start*/, size_t len)
+{
+	std::lock_guard<std::mutex> lock(s_directMemoryMutex);
+	if (len > s_allocatedBytes) return SCE_KERNEL_ERROR_EINVAL;
+	s_allocatedBytes -= len;
+	return SCE_OK;
+}
+
+//[comment]
+// The mapping comes from MapPages of the desktop framework's LinearAllocator.h, aligned to maxPageSize
+// (64 KiB for the allocators). A maxPageSize of 2 MiB or more asks for large pages like on the console:
+// hugetlbfs pages if the system has them reserved, otherwise transparent huge pages. Only lengths that
+// are whole large pages get them, so MapPages never maps more than sceKernelMunmap is given back.
+// Direct memory is always resident, building with SHIM_LOCK_DIRECT_MEMORY locks the mappings (as far
+// as RLIMIT_MEMLOCK allows) to match.
+//[/comment]
+int32_t sceKernelMapDirectMemory(void** addr, size_t len, int protection, int /*flags*/, off_t /*directMemoryStart*/, size_t maxPageSize)
+{
+	if (addr == nullptr || len == 0) return SCE_KERNEL_ERROR_EINVAL;
+	len = (len + 4095) & ~(size_t)4095;
+	int pageFlags = maxPageSize >= HUGE_PAGE_SIZE && len % HUGE_PAGE_SIZE == 0 ? LINEAR_ALLOCATOR_HUGE_PAGES : 0;
+#ifdef SHIM_LOCK_DIRECT_MEMORY
+	pageFlags |= LINEAR_ALLOCATOR_LOCKED;
+#endif
+	PageKind kind;
+	bool locked;
+	void* result = MapPages(len, pageFlags, kind, locked, maxPageSize);
+	if (result == nullptr) return SCE_KERNEL_ERROR_ENOMEM;
+	int cpuProtection = ((protection & SCE_KERNEL_PROT_CPU_READ) ? PROT_READ : 0) | ((protection & SCE_KERNEL_PROT_CPU_WRITE) ? PROT_WRITE : 0);
+	if (cpuProtection != (PROT_READ | PROT_WRITE)) mprotect(result, len, cpuProtection);
+	*addr = result;
+	return SCE_OK;
+}
+
+int32_t sceKernelMunmap(void* addr, size_t len)
+{
+	return UnmapPages(addr, len) ? SCE_OK : SCE_KERNEL_ERROR_EINVAL;
+}
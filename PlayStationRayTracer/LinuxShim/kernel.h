@@ -0,0 +1,31 @@
+#pragma once
+#include <sys/types.h>
+#include "scebase.h"
+
+//[comment]
+// Linux stand-in for the direct memory calls of the SDK's kernel library, implemented in kernel.cpp.
+// Direct memory is emulated: allocating only hands out an offset within a pretend physical range
+// of sceKernelGetDirectMemorySize() bytes, mapping it creates anonymous memory with the requested
+// alignment (and large pages for a maxPageSize of 2 MiB, see kernel.cpp), and unmapping gives that
+// back to the OS. Two mappings of one offset don't share pages.
+//[/comment]
+typedef int SceKernelMemoryType;
+#define SCE_KERNEL_WB_ONION 0
+#define SCE_KERNEL_WC_GARLIC 3
+
+#define SCE_KERNEL_PROT_CPU_READ 0x01
+#define SCE_KERNEL_PROT_CPU_WRITE 0x02
+#define SCE_KERNEL_PROT_CPU_RW (SCE_KERNEL_PROT_CPU_READ | SCE_KERNEL_PROT_CPU_WRITE)
+#define SCE_KERNEL_PROT_GPU_READ 0x10
+#define SCE_KERNEL_PROT_GPU_WRITE 0x20
+#define SCE_KERNEL_PROT_GPU_RW (SCE_KERNEL_PROT_GPU_READ | SCE_KERNEL_PROT_GPU_WRITE)
+#define SCE_KERNEL_PROT_GPU_ALL SCE_KERNEL_PROT_GPU_RW
+
+#define SCE_KERNEL_ERROR_ENOMEM 0x8002000c
+#define SCE_KERNEL_ERROR_EINVAL 0x80020016
+
+size_t sceKernelGetDirectMemorySize();
+int32_t sceKernelAllocateDirectMemory(off_t searchStart, off_t searchEnd, size_t len, size_t alignment, int memoryType, off_t* physicalAddressDestination);
+int32_t sceKernelReleaseDirectMemory(off_t start, size_t len);
+int32_t sceKernelMapDirectMemory(void** addr, size_t len, int protection, int flags, off_t directMemoryStart, size_t maxPageSize);
+int32_t sceKernelMunmap(void* addr, size_t len);
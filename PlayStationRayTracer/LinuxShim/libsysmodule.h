@@ -0,0 +1,11 @@
+#pragma once
+#include "scebase.h"
+
+//[comment]
+// Linux stand-in for the SDK's system module loader. The shim's libraries are linked in, so
+// loading and unloading a module always succeeds.
+//[/comment]
+#define SCE_SYSMODULE_ULT 0x0025
+
+inline int32_t sceSysmoduleLoadModule(uint16_t /*id*/) { return SCE_OK; }
+inline int32_t sceSysmoduleUnloadModule(uint16_t /*id*/) { return SCE_OK; }
@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+//[comment]
+// Linux stand-in for the SDK's base header, see ult.h for what the shim covers and how to build with it.
+//[/comment]
+#define SCE_OK 0
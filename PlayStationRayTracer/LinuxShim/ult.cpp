@@ -0,0 +1,231 @@
+#include <new>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include "ult.h"
+
+//[comment]
+// A runtime: its worker threads take ulthreads from the front of the ready queue and switch to
+// them until they yield (back to the end of the queue) or return (finished, joiners are woken).
+// An ulthread may continue on a different worker after a yield, like on the console.
+//[/comment]
+struct UltRuntime
+{
+	std::string name;
+	uint32_t maxUlthreads;
+	uint32_t liveUlthreads; //created and not joined yet
+	std::vector<std::thread> workers;
+	std::deque<SceUltUlthread*> ready;
+	std::mutex mutex;
+	std::condition_variable readyChanged;
+	std::condition_variable finished;
+	bool stopping;
+
+	//statistics printed by sceUltUlthreadRuntimeDestroy
+	unsigned long long ulthreadsRun, switches;
+	uint64_t deepestStack, smallestStack;
+	bool overflowed;
+	double busySeconds;
+};
+
+//fill of every stack, what is still untouched at the end of a run shows how deep the stack got
+static const unsigned char kStackFill = 0xCD;
+
+//[comment]
+// The ulthread the calling worker is running, only written by WorkerLoop. An ulthread can resume on
+// another worker after a switch, and the compiler is free to keep the address of a thread_local
+// from before a call, so ulthread code never reads t_current after switching: it reads it once
+// through CurrentUlthread (not inlined, so the address is computed on the worker it runs on) and
+// switches with SwitchToWorker on the ulthread it got, whose worker field the resuming worker sets.
+//[/comment]
+static thread_local SceUltUlthread* t_current = nullptr;
+
+static __attribute__((noinline)) SceUltUlthread* CurrentUlthread()
+{
+	return t_current;
+}
+
+//suspends the ulthread and continues the worker that is running it, returns once a worker resumes it
+static void SwitchToWorker(SceUltUlthread* self)
+{
+	swapcontext(&self->context, self->worker);
+}
+
+static void UlthreadMain(unsigned int high, unsigned int low)
+{
+	SceUltUlthread* ulthread = (SceUltUlthread*)(uintptr_t)(((unsigned long long)high << 32) | low);
+	ulthread->status = ulthread->entry(ulthread->arg);
+	ulthread->exited = true;
+	SwitchToWorker(ulthread);
+}
+
+//bytes of the stack the ulthread has written, the stack grows down from the end of the buffer
+static uint64_t StackUsed(const SceUltUlthread* ulthread)
+{
+	uint64_t untouched = 0;
+	while (untouched < ulthread->stackSize && ulthread->stack[untouched] == kStackFill) untouched++;
+	return ulthread->stackSize - untouched;
+}
+
+static void WorkerLoop(UltRuntime* runtime)
+{
+	ucontext_t workerContext;
+	std::unique_lock<std::mutex> lock(runtime->mutex);
+	while (true) {
+		runtime->readyChanged.wait(lock, [&] { return runtime->stopping || !runtime->ready.empty(); });
+		if (runtime->ready.empty()) return; //only when stopping
+		SceUltUlthread* ulthread = runtime->ready.front();
+		runtime->ready.pop_front();
+		lock.unlock();
+
+		auto start = std::chrono::steady_clock::now();
+		ulthread->worker = &workerContext;
+		t_current = ulthread;
+		swapcontext(&workerContext, &ulthread->context);
+		t_current = nullptr;
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		lock.lock();
+		runtime->switches++;
+		runtime->busySeconds += seconds;
+		if (ulthread->exited) {
+			ulthread->finished = true;
+			uint64_t used = StackUsed(ulthread);
+			runtime->deepestStack = std::max(runtime->deepestStack, used);
+			runtime->smallestStack = std::min(runtime->smallestStack, ulthread->stackSize);
+			runtime->overflowed |= used == ulthread->stackSize;
+			runtime->ulthreadsRun++;
+			runtime->finished.notify_all();
+		}
+		else {
+			runtime->ready.push_back(ulthread);
+			runtime->readyChanged.notify_one();
+		}
+	}
+}
+
+int32_t sceUltInitialize()
+{
+	return SCE_OK;
+}
+
+int32_t sceUltFinalize()
+{
+	return SCE_OK;
+}
+
+uint64_t sceUltUlthreadRuntimeGetWorkAreaSize(uint32_t /*maxNumUlthread*/, uint32_t /*numWorkerThread*/)
+{
+	return sizeof(UltRuntime) + alignof(UltRuntime);
+}
+
+int32_t sceUltUlthreadRuntimeCreate(SceUltUlthreadRuntime* runtime, const char* name, uint32_t maxNumUlthread, uint32_t numWorkerThread, void* workArea, const SceUltUlthreadRuntimeOptParam* /*optParam*/)
+{
+	if (runtime == nullptr || workArea == nullptr) return SCE_ULT_ERROR_NULL;
+	if (maxNumUlthread == 0 || numWorkerThread == 0) return SCE_ULT_ERROR_RANGE;
+	uintptr_t address = ((uintptr_t)workArea + alignof(UltRuntime) - 1) & ~(uintptr_t)(alignof(UltRuntime) - 1);
+	UltRuntime* impl = new ((void*)address) UltRuntime();
+	impl->name = name ? name : "";
+	impl->maxUlthreads = maxNumUlthread;
+	impl->liveUlthreads = 0;
+	impl->stopping = false;
+	impl->ulthreadsRun = impl->switches = 0;
+	impl->deepestStack = 0;
+	impl->smallestStack = UINT64_MAX;
+	impl->overflowed = false;
+	impl->busySeconds = 0;
+	for (uint32_t i = 0; i < numWorkerThread; ++i) impl->workers.emplace_back(WorkerLoop, impl);
+	runtime->impl = impl;
+	return SCE_OK;
+}
+
+int32_t sceUltUlthreadRuntimeDestroy(SceUltUlthreadRuntime* runtime)
+{
+	if (runtime == nullptr || runtime->impl == nullptr) return SCE_ULT_ERROR_NULL;
+	UltRuntime* impl = (UltRuntime*)runtime->impl;
+	{
+		std::lock_guard<std::mutex> lock(impl->mutex);
+		if (impl->liveUlthreads > 0) return SCE_ULT_ERROR_BUSY;
+		impl->stopping = true;
+	}
+	impl->readyChanged.notify_all();
+	for (std::thread& worker : impl->workers) worker.join();
+
+	printf("ULT runtime %s: %u workers ran %llu ulthreads in %llu switches, %.3fs busy. Deepest stack %llu of %llu bytes%s.\n",
+		impl->name.c_str(), (unsigned)impl->workers.size(), impl->ulthreadsRun, impl->switches, impl->busySeconds,
+		(unsigned long long)impl->deepestStack, (unsigned long long)(impl->ulthreadsRun ? impl->smallestStack : 0),
+		impl->overflowed ? ", OVERFLOWED" : "");
+
+	impl->~UltRuntime();
+	runtime->impl = nullptr;
+	return SCE_OK;
+}
+
+int32_t sceUltUlthreadCreate(SceUltUlthread* ulthread, const char* /*name*/, SceUltUlthreadEntry entry, uint64_t arg, void* context, uint64_t sizeContext, SceUltUlthreadRuntime* runtime, const SceUltUlthreadOptParam* /*optParam*/)
+{
+	if (ulthread == nullptr || entry == nullptr || context == nullptr || runtime == nullptr || runtime->impl == nullptr) return SCE_ULT_ERROR_NULL;
+	if (sizeContext < 4096) return SCE_ULT_ERROR_RANGE;
+	UltRuntime* impl = (UltRuntime*)runtime->impl;
+
+	ulthread->entry = entry;
+	ulthread->arg = arg;
+	ulthread->stack = (unsigned char*)context;
+	ulthread->stackSize = sizeContext;
+	ulthread->runtime = runtime;
+	ulthread->status = 0;
+	ulthread->exited = false;
+	ulthread->finished = false;
+	memset(ulthread->stack, kStackFill, sizeContext);
+	getcontext(&ulthread->context);
+	ulthread->context.uc_stack.ss_sp = ulthread->stack;
+	ulthread->context.uc_stack.ss_size = sizeContext;
+	ulthread->context.uc_link = nullptr;
+	unsigned long long address = (uintptr_t)ulthread;
+	makecontext(&ulthread->context, (void(*)())UlthreadMain, 2, (unsigned int)(address >> 32), (unsigned int)address);
+
+	{
+		std::lock_guard<std::mutex> lock(impl->mutex);
+		if (impl->liveUlthreads == impl->maxUlthreads) return SCE_ULT_ERROR_BUSY;
+		impl->liveUlthreads++;
+		impl->ready.push_back(ulthread);
+	}
+	impl->readyChanged.notify_one();
+	return SCE_OK;
+}
+
+int32_t sceUltUlthreadJoin(SceUltUlthread* ulthread, int32_t* status)
+{
+	if (ulthread == nullptr || ulthread->runtime == nullptr) return SCE_ULT_ERROR_NULL;
+	SceUltUlthread* self = CurrentUlthread();
+	if (ulthread == self) return SCE_ULT_ERROR_STATE;
+	UltRuntime* impl = (UltRuntime*)ulthread->runtime->impl;
+	std::unique_lock<std::mutex> lock(impl->mutex);
+	if (self) {
+		//an ulthread can't block its worker, it lets the others run until the joined one is done
+		while (!ulthread->finished) {
+			lock.unlock();
+			SwitchToWorker(self);
+			lock.lock();
+		}
+	}
+	else impl->finished.wait(lock, [&] { return ulthread->finished; });
+	impl->liveUlthreads--;
+	if (status) *status = ulthread->status;
+	ulthread->runtime = nullptr; //joined, a second join fails
+	return SCE_OK;
+}
+
+int32_t sceUltUlthreadYield()
+{
+	SceUltUlthread* self = CurrentUlthread();
+	if (self == nullptr) return SCE_ULT_ERROR_STATE;
+	SwitchToWorker(self);
+	return SCE_OK;
+}
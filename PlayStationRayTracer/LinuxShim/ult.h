@@ -0,0 +1,61 @@
+#pragma once
+#include <ucontext.h>
+#include "scebase.h"
+
+//[comment]
+// Linux stand-in for the part of the SDK's user level thread library the ray tracer uses, so its
+// ULT render path runs (and can be profiled) without a devkit. Implemented in ult.cpp on ucontext
+// fibers and std::thread workers:
+// - a runtime owns numWorkerThread OS threads that run the ulthreads of a shared ready queue,
+// - an ulthread runs on the context buffer it was created with, the whole buffer is its stack, so a
+//   CONTEXT_SIZE that is too small fails here as it does on the console,
+// - sceUltUlthreadYield puts the calling ulthread back at the end of the queue,
+// - sceUltUlthreadJoin blocks an OS thread, or yields while called from an ulthread.
+// Destroying a runtime prints how many ulthreads it ran, how many switches that took and the
+// deepest any ulthread's stack got, which is what NUM_THREADS and CONTEXT_SIZE are tuned with.
+//
+// Build the PlayStation ray tracer on Linux from PlayStationRayTracer/PlayStationRayTracer with
+//   g++ -std=c++11 -O2 -pthread -I../LinuxShim main.cpp MemoryDebugger.cpp ../LinuxShim/ult.cpp ../LinuxShim/kernel.cpp -o PlayStationRayTracer
+// adding -D_DEBUG for the memory debugger and -DNUM_THREADS=n -DCONTEXT_SIZE=bytes to tune.
+//[/comment]
+
+#define SCE_ULT_ERROR_NULL 0x80810001
+#define SCE_ULT_ERROR_INVALID 0x80810004
+#define SCE_ULT_ERROR_RANGE 0x80810003
+#define SCE_ULT_ERROR_BUSY 0x80810005
+#define SCE_ULT_ERROR_STATE 0x80810007
+
+typedef int32_t (*SceUltUlthreadEntry)(uint64_t arg);
+
+struct SceUltUlthreadRuntimeOptParam;
+struct SceUltUlthreadOptParam;
+
+struct SceUltUlthreadRuntime
+{
+	void* impl; //placed in the work area
+};
+
+struct SceUltUlthread
+{
+	ucontext_t context;
+	ucontext_t* worker; //context of the worker running the ulthread, switched back to on yield and exit
+	SceUltUlthreadEntry entry;
+	uint64_t arg;
+	unsigned char* stack;
+	uint64_t stackSize;
+	SceUltUlthreadRuntime* runtime;
+	int32_t status;
+	bool exited;   //set by the ulthread itself, only read by the worker it switched back to
+	bool finished; //set by that worker under the runtime's lock, what joiners wait for
+};
+
+int32_t sceUltInitialize();
+int32_t sceUltFinalize();
+
+uint64_t sceUltUlthreadRuntimeGetWorkAreaSize(uint32_t maxNumUlthread, uint32_t numWorkerThread);
+int32_t sceUltUlthreadRuntimeCreate(SceUltUlthreadRuntime* runtime, const char* name, uint32_t maxNumUlthread, uint32_t numWorkerThread, void* workArea, const SceUltUlthreadRuntimeOptParam* optParam);
+int32_t sceUltUlthreadRuntimeDestroy(SceUltUlthreadRuntime* runtime);
+
+int32_t sceUltUlthreadCreate(SceUltUlthread* ulthread, const char* name, SceUltUlthreadEntry entry, uint64_t arg, void* context, uint64_t sizeContext, SceUltUlthreadRuntime* runtime, const SceUltUlthreadOptParam* optParam);
+int32_t sceUltUlthreadJoin(SceUltUlthread* ulthread, int32_t* status);
+int32_t sceUltUlthreadYield();
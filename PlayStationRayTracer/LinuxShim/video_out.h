@@ -0,0 +1,7 @@
+#pragma once
+#include "scebase.h"
+
+//[comment]
+// Linux stand-in for the SDK's video out header. The ray tracer writes its frames to files and
+// never scans out, so nothing of it is needed.
+//[/comment]
@@ -23,18 +23,35 @@ template<typename T> inline T alignTo(const T size, const T alignment)
 	return ((size + alignment-T(1)) / alignment) * alignment;
 }
 
+//direct memory mappings made and released by all the LinearAllocators, see LinearAllocator::statistics
+struct LinearAllocatorStatistics
+{
+	uint64_t mappings;
+	uint64_t unmappings;
+	size_t mappedBytes;
+	size_t peakMappedBytes;
+};
+
 class LinearAllocator
 {
 public:
+	typedef size_t Marker;
+
 	LinearAllocator()
 	:
 		m_baseAddr(NULL),
 		m_dmemOffset(0),
 		m_curSize(0),
-		m_maxSize(0)
+		m_maxSize(0),
+		m_peakSize(0)
 	{
 	}
 
+	~LinearAllocator()
+	{
+		terminate();
+	}
+
 	int32_t initialize(
 		const size_t memorySize,
 		const SceKernelMemoryType memoryType,
@@ -80,6 +97,12 @@ public:
 
 		m_baseAddr = static_cast<uint8_t*>(baseAddress);
 
+		LinearAllocatorStatistics &stats = statistics();
+		stats.mappings++;
+		stats.mappedBytes += m_maxSize;
+		if( stats.mappedBytes > stats.peakMappedBytes )
+			stats.peakMappedBytes = stats.mappedBytes;
+
 		return SCE_OK;
 	}
 
@@ -95,6 +118,12 @@ public:
 				printf("sceKernelMunmap failed: 0x%08X\n", tmpRet);
 				ret = tmpRet;
 			}
+			else
+			{
+				LinearAllocatorStatistics &stats = statistics();
+				stats.unmappings++;
+				stats.mappedBytes -= m_maxSize;
+			}
 		}
 
 		if( m_dmemOffset )
@@ -111,6 +140,7 @@ public:
 		m_dmemOffset = 0;
 		m_curSize = 0;
 		m_maxSize = 0;
+		m_peakSize = 0;
 
 		return ret;
 	}
@@ -124,10 +154,50 @@ public:
 			return NULL;
 
 		m_curSize = newSize;
+		if( m_curSize > m_peakSize )
+			m_peakSize = m_curSize;
 
 		return m_baseAddr + offset;
 	}
 
+	// Everything allocated after getMarker() is given back by rewind(marker), reset() gives back
+	// everything. The memory stays mapped, so it is reused without another kernel call.
+	Marker getMarker() const
+	{
+		return m_curSize;
+	}
+
+	void rewind(Marker marker)
+	{
+		m_curSize = marker;
+	}
+
+	void reset()
+	{
+		m_curSize = 0;
+	}
+
+	size_t getUsedSize() const
+	{
+		return m_curSize;
+	}
+
+	size_t getPeakSize() const
+	{
+		return m_peakSize;
+	}
+
+	size_t getMaxSize() const
+	{
+		return m_maxSize;
+	}
+
+	static LinearAllocatorStatistics& statistics()
+	{
+		static LinearAllocatorStatistics stats = { 0, 0, 0, 0 };
+		return stats;
+	}
+
 	void* allocate(sce::Gnm::SizeAlign sizeAlign)
 	{
 		return allocate(sizeAlign.m_size, sizeAlign.m_align);
@@ -157,6 +227,7 @@ private:
 	off_t m_dmemOffset;
 	size_t m_curSize;
 	size_t m_maxSize;
+	size_t m_peakSize;
 };
 
 #endif
@@ -35,14 +35,21 @@
 
 
 
-static const size_t kOnionMemorySize = 64 * 1024 * 1024;
-
 std::chrono::time_point<std::chrono::system_clock> start;
 std::chrono::time_point<std::chrono::system_clock> end;
 std::chrono::duration<double> total_elapsed_time;
 
+//[comment]
+// Stack and context bytes of every render ulthread, and the number of ulthreads (one band each)
+// and of worker threads running them. Both can be set on the compile line, which is how they are
+// tuned with the Linux build of the ULT runtime (see LinuxShim/ult.h).
+//[/comment]
+#ifndef CONTEXT_SIZE
 #define CONTEXT_SIZE 16384
+#endif
+#ifndef NUM_THREADS
 #define NUM_THREADS 12
+#endif
 static uint64_t workerContextBuffer[NUM_THREADS][CONTEXT_SIZE / sizeof(uint64_t)];
 
 using namespace sce;
@@ -118,6 +125,114 @@ public:
 
 		return true;
 	}
+	//[comment]
+	// Any-hit version of intersect for shadow rays. True if the ray enters the sphere before tmax,
+	// found without the square root and without computing the hit distances.
+	//[/comment]
+	bool occluded(const Vec3f& rayorig, const Vec3f& raydir, const float& tmax) const
+	{
+		Vec3f l = center - rayorig;
+		float tca = l.dot(raydir);
+		if (tca < 0) return false;
+		float d2 = l.dot(l) - tca * tca;
+		if (d2 > radius2) return false;
+		//the entry point tca - sqrt(radius2 - d2) is closer than tmax if tca - tmax < sqrt(radius2 - d2)
+		float beyond = tca - tmax;
+		return beyond < 0 || beyond * beyond < radius2 - d2;
+	}
+};
+
+//position and size of a sphere, all the intersection tests need
+struct SphereGeometry
+{
+	Vec3f center;
+	float radius2;
+
+	//same tests as Sphere::intersect and Sphere::occluded
+	bool intersect(const Vec3f& rayorig, const Vec3f& raydir, float& t0, float& t1) const
+	{
+		Vec3f l = center - rayorig;
+		float tca = l.dot(raydir);
+		if (tca < 0) return false;
+		float d2 = l.dot(l) - tca * tca;
+		if (d2 > radius2) return false;
+		float thc = sqrt(radius2 - d2);
+		t0 = tca - thc;
+		t1 = tca + thc;
+		return true;
+	}
+	bool occluded(const Vec3f& rayorig, const Vec3f& raydir, const float& tmax) const
+	{
+		Vec3f l = center - rayorig;
+		float tca = l.dot(raydir);
+		if (tca < 0) return false;
+		float d2 = l.dot(l) - tca * tca;
+		if (d2 > radius2) return false;
+		float beyond = tca - tmax;
+		return beyond < 0 || beyond * beyond < radius2 - d2;
+	}
+};
+
+//surface properties of a sphere, only looked up once a hit has been found
+struct Material
+{
+	Vec3f surfaceColor, emissionColor;
+	float transparency, reflection;
+};
+
+//an emissive sphere, gathered once per frame so the diffuse shading loop doesn't rescan the scene
+struct Light
+{
+	Vec3f center, emissionColor;
+	int index; //index of the light in geometry, its own shadow rays never count it as a blocker
+};
+
+//[comment]
+// Immutable render scene, compiled once per frame before the user level threads are created and
+// then only read by them. The geometry is one contiguous array that the intersection loops stream
+// through, the materials sit in a separate table with the same index, and the lights are listed
+// up front. Compiling keeps the capacity of the vectors, so it doesn't allocate every frame.
+//[/comment]
+class CompiledScene
+{
+public:
+	std::vector<SphereGeometry> geometry;
+	std::vector<Material> materials;
+	std::vector<Light> lights;
+	bool noLights;
+
+	CompiledScene() : noLights(true) {}
+
+	void Compile(const std::vector<Sphere*>& objects)
+	{
+		geometry.clear();
+		materials.clear();
+		lights.clear();
+		for (unsigned i = 0; i < objects.size(); ++i) {
+			const Sphere* sphere = objects[i];
+			if (sphere == nullptr) continue;
+			if (sphere->emissionColor.x > 0) {
+				Light light;
+				light.center = sphere->center;
+				light.emissionColor = sphere->emissionColor;
+				light.index = (int)geometry.size();
+				lights.push_back(light);
+			}
+			SphereGeometry g;
+			g.center = sphere->center;
+			g.radius2 = sphere->radius2;
+			geometry.push_back(g);
+			Material m;
+			m.surfaceColor = sphere->surfaceColor;
+			m.emissionColor = sphere->emissionColor;
+			m.transparency = sphere->transparency;
+			m.reflection = sphere->reflection;
+			materials.push_back(m);
+		}
+		noLights = lights.empty();
+	}
+
+	int count() const { return (int)geometry.size(); }
 };
 
 //[comment]
@@ -143,28 +258,29 @@ float mix(const float& a, const float& b, const float& mix)
 Vec3f trace(
 	const Vec3f& rayorig,
 	const Vec3f& raydir,
-	const std::vector<Sphere*>& spheres,
+	const CompiledScene& scene,
 	const int& depth)
 {
 	//if (raydir.length() != 1) std::cerr << "Error " << raydir << std::endl;
 	float tnear = INFINITY;
-	const Sphere* sphere = NULL;
+	int hitIndex = -1;
 	// find intersection of this ray with the sphere in the scene
-	for (unsigned i = 0; i < spheres.size(); ++i) {
+	for (int i = 0; i < scene.count(); ++i) {
 		float t0 = INFINITY, t1 = INFINITY;
-		if (spheres[i]->intersect(rayorig, raydir, t0, t1)) {
+		if (scene.geometry[i].intersect(rayorig, raydir, t0, t1)) {
 			if (t0 < 0) t0 = t1;
 			if (t0 < tnear) {
 				tnear = t0;
-				sphere = spheres[i];
+				hitIndex = i;
 			}
 		}
 	}
 	// if there's no intersection return black or background color
-	if (!sphere) return Vec3f(2);
+	if (hitIndex < 0) return Vec3f(2);
+	const Material& material = scene.materials[hitIndex];
 	Vec3f surfaceColor = 0; // color of the ray/surfaceof the object intersected by the ray
 	Vec3f phit = rayorig + raydir * tnear; // point of intersection
-	Vec3f nhit = phit - sphere->center; // normal at the intersection point
+	Vec3f nhit = phit - scene.geometry[hitIndex].center; // normal at the intersection point
 	nhit.normalize(); // normalize normal direction
 	// If the normal and the view direction are not opposite to each other
 	// reverse the normal direction. That also means we are inside the sphere so set
@@ -173,7 +289,7 @@ Vec3f trace(
 	float bias = 1e-4; // add some bias to the point from which we will be tracing
 	bool inside = false;
 	if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true;
-	if ((sphere->transparency > 0 || sphere->reflection > 0) && depth < MAX_RAY_DEPTH) {
+	if ((material.transparency > 0 || material.reflection > 0) && depth < MAX_RAY_DEPTH) {
 		float facingratio = -raydir.dot(nhit);
 		// change the mix value to tweak the effect
 		float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
@@ -186,48 +302,49 @@ Vec3f trace(
 
 
 		// if the sphere is also transparent compute refraction ray (transmission)
-		if (sphere->reflection > 0) {
+		if (material.reflection > 0) {
 			Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
 			refldir.normalize();
-			reflection = trace(phit + nhit * bias, refldir, spheres, depth + 1);
+			reflection = trace(phit + nhit * bias, refldir, scene, depth + 1);
 			surfaceColor += reflection * fresneleffect;
 		}
-		if (sphere->transparency > 0) {
+		if (material.transparency > 0) {
 			float ior = 1.1, eta = (inside) ? ior : 1 / ior; // are we inside or outside the surface?
 			float cosi = -nhit.dot(raydir);
 			float k = 1 - eta * eta * (1 - cosi * cosi);
 			Vec3f refrdir = raydir * eta + nhit * (eta * cosi - sqrt(k));
 			refrdir.normalize();
-			refraction = trace(phit - nhit * bias, refrdir, spheres, depth + 1);
-			surfaceColor += refraction * (1 - fresneleffect) * sphere->transparency;
+			refraction = trace(phit - nhit * bias, refrdir, scene, depth + 1);
+			surfaceColor += refraction * (1 - fresneleffect) * material.transparency;
 		}
 		// the result is a mix of reflection and refraction (if the sphere is transparent)
-		surfaceColor *= sphere->surfaceColor;
+		surfaceColor *= material.surfaceColor;
 	}
 	else {
 		// it's a diffuse object, no need to raytrace any further
-		for (unsigned i = 0; i < spheres.size(); ++i) {
-			if (spheres[i]->emissionColor.x > 0) {
-				// this is a light
+		//optimization: only the precomputed lights are visited, scenes without lights skip the loop
+		if (!scene.noLights) {
+			for (const Light& light : scene.lights) {
 				Vec3f transmission = 1;
-				Vec3f lightDirection = spheres[i]->center - phit;
+				Vec3f lightDirection = light.center - phit;
+				float lightDistance = lightDirection.length(); //spheres behind the light don't cast a shadow
 				lightDirection.normalize();
-				for (unsigned j = 0; j < spheres.size(); ++j) {
-					if (i != j) {
-						float t0, t1;
-						if (spheres[j]->intersect(phit + nhit * bias, lightDirection, t0, t1)) {
+				for (int j = 0; j < scene.count(); ++j) {
+					if (j != light.index) {
+						//optimization: any-hit test, no square root and no hit distances
+						if (scene.geometry[j].occluded(phit + nhit * bias, lightDirection, lightDistance)) {
 							transmission = 0;
 							break;
 						}
 					}
 				}
-				surfaceColor += sphere->surfaceColor * transmission *
-					std::max(float(0), nhit.dot(lightDirection)) * spheres[i]->emissionColor;
+				surfaceColor += material.surfaceColor * transmission *
+					std::max(float(0), nhit.dot(lightDirection)) * light.emissionColor;
 			}
 		}
 	}
 
-	return surfaceColor + sphere->emissionColor;
+	return surfaceColor + material.emissionColor;
 }
 
 //[comment]
@@ -235,7 +352,7 @@ Vec3f trace(
 // trace it and return a color. If the ray hits a sphere, we return the color of the
 // sphere at the intersection point, else we return the background color.
 //[/comment]
-void render(const std::vector<Sphere*>& spheres, int iteration, Vec3f* image, const int maxSubdivisions, const int thisSubdivision, unsigned const width, unsigned const height)
+void render(const CompiledScene& scene, int iteration, Vec3f* image, const int maxSubdivisions, const int thisSubdivision, unsigned const width, unsigned const height)
 {
 	Vec3f* pixel = image; //copy of pointer to be used for iteration
 	float invWidth = 2 / float(width), invHeight = 2 / float(height); //optimization: rather than multiplying by 2 on every iteration, just do it here once.
@@ -261,7 +378,7 @@ void render(const std::vector<Sphere*>& spheres, int iteration, Vec3f* image, co
 			float yy = (1 - y * invHeight) * angle;
 			Vec3f raydir(xx, yy, -1);
 			raydir.normalize();
-			Vec3f temp = trace(zero, raydir, spheres, 0);
+			Vec3f temp = trace(zero, raydir, scene, 0);
 			*pixel = temp;
 		}
 	}
@@ -271,7 +388,11 @@ void FileCreation(int width, int height, Vec3f* image, int iteration)
 {
 	// Save result to a PPM image (keep these flags if you compile under Windows)
 	std::stringstream ss;
+#ifdef __ORBIS__
 	ss << "/app0/spheres" << iteration << ".ppm";
+#else
+	ss << "./spheres" << iteration << ".ppm"; //Linux build, see LinuxShim/ult.h
+#endif
 	std::string tempString = ss.str();
 	char* filename = (char*)tempString.c_str();
 
@@ -287,7 +408,7 @@ void FileCreation(int width, int height, Vec3f* image, int iteration)
 
 struct attributes 
 {
-	std::vector<Sphere*>* spheres;
+	const CompiledScene* scene;
 	int iteration;
 	Vec3f* image;
 	int maxSubdivisions;
@@ -296,48 +417,104 @@ struct attributes
 	int height;
 };
 
+//[comment]
+// Framebuffers in the ring of the frame arena. A frame's buffer is only handed out again
+// FRAME_RING_SIZE frames later. BasicRender writes a frame's file before the next frame is traced,
+// so one buffer is all that is ever in use; more only pay off once the write overlaps the next frame.
+//[/comment]
+#define FRAME_RING_SIZE 1
+//bytes of scratch memory a frame can allocate (the ulthread arguments), mapped after the framebuffers
+#define FRAME_SCRATCH_SIZE (64 * 1024)
+
+//[comment]
+// Direct memory of a whole run: one onion mapping made once, holding a ring of framebuffers that
+// the frames take in turn, followed by per-frame scratch memory. It is sized for exactly that. beginFrame rewinds the scratch
+// memory instead of mapping new memory, so a run of any length maps exactly once and gives the
+// mapping back in terminate. The statistics show the mappings made and the peak memory used.
+//[/comment]
+class FrameArena
+{
+private:
+	LinearAllocator m_allocator;
+	Vec3f* m_frames[FRAME_RING_SIZE];
+	LinearAllocator::Marker m_scratchStart; //end of the framebuffers, what beginFrame rewinds to
+	unsigned m_width, m_height;
+	int m_frameCount;
+	size_t m_peakUsed, m_capacity; //kept for the statistics once the memory is given back
+public:
+	FrameArena() : m_scratchStart(0), m_width(0), m_height(0), m_frameCount(0), m_peakUsed(0), m_capacity(0) {}
+
+	int32_t initialize(unsigned width, unsigned height)
+	{
+		size_t frameSize = sizeof(Vec3f) * width * height + Gnm::kAlignmentOfBufferInBytes; //with room to align it
+		int32_t ret = m_allocator.initialize(frameSize * FRAME_RING_SIZE + FRAME_SCRATCH_SIZE, SCE_KERNEL_WB_ONION, SCE_KERNEL_PROT_CPU_RW | SCE_KERNEL_PROT_GPU_ALL);
+		if (ret != SCE_OK) return ret;
+		for (int i = 0; i < FRAME_RING_SIZE; i++) {
+			m_frames[i] = reinterpret_cast<Vec3f*>(m_allocator.allocate(sizeof(Vec3f) * width * height, Gnm::kAlignmentOfBufferInBytes));
+			if (m_frames[i] == NULL) return SCE_KERNEL_ERROR_ENOMEM;
+		}
+		m_scratchStart = m_allocator.getMarker();
+		m_width = width;
+		m_height = height;
+		m_frameCount = 0;
+		return SCE_OK;
+	}
+	int32_t terminate()
+	{
+		m_peakUsed = m_allocator.getPeakSize();
+		m_capacity = m_allocator.getMaxSize();
+		return m_allocator.terminate();
+	}
+
+	//the framebuffer of the next frame, the scratch memory of the previous frame is given back
+	Vec3f* beginFrame()
+	{
+		m_allocator.rewind(m_scratchStart);
+		return m_frames[m_frameCount++ % FRAME_RING_SIZE];
+	}
+	//memory that lives until the next beginFrame
+	void* allocateScratch(size_t size, size_t align) { return m_allocator.allocate(size, align); }
+
+	unsigned width() const { return m_width; }
+	unsigned height() const { return m_height; }
+
+	//complete once the arena is terminated
+	void printStatistics() const
+	{
+		const LinearAllocatorStatistics& stats = LinearAllocator::statistics();
+		std::cout << "Frame arena: " << m_frameCount << " frames in a ring of " << FRAME_RING_SIZE << ", peak " << m_peakUsed / 1024 << " of "
+			<< m_capacity / 1024 << " KiB used. Direct memory: " << stats.mappings << " mappings, " << stats.unmappings << " unmappings, peak "
+			<< stats.peakMappedBytes / 1024 << " KiB mapped." << std::endl;
+	}
+};
+
 //wrapper for the render function
 int32_t renderThreadEntry(uint64_t arg)
 {
 	attributes* attr = (attributes*)arg;
-	render(*attr->spheres, attr->iteration, attr->image, attr->maxSubdivisions, attr->thisSubdivision, attr->width, attr->height);
+	render(*attr->scene, attr->iteration, attr->image, attr->maxSubdivisions, attr->thisSubdivision, attr->width, attr->height);
 	return SCE_OK;
 }
 
 
-void BasicRender(int iteration, std::vector<Sphere*>& spheres, int concurrencyVal, SceUltUlthreadRuntime& runtime)
+void BasicRender(int iteration, const CompiledScene& scene, int concurrencyVal, SceUltUlthreadRuntime& runtime, FrameArena& arena)
 {
 	auto start = std::chrono::system_clock::now(); //start counting
 
-	// Initialize the WB_ONION memory allocator
-
-	LinearAllocator onionAllocator;
-	int ret = onionAllocator.initialize(
-		kOnionMemorySize, SCE_KERNEL_WB_ONION,
-		SCE_KERNEL_PROT_CPU_RW | SCE_KERNEL_PROT_GPU_ALL);
-
-	//if (ret != SCE_OK)
-	//	return ret;
-
-	unsigned width = 1920, height = 1080;
-	size_t totalSize = sizeof(Vec3f) * width * height;
-
-	void* buffer = onionAllocator.allocate(totalSize, Gnm::kAlignmentOfBufferInBytes);
-
-	Vec3f* image = reinterpret_cast<Vec3f*>(buffer);
-
-
-
+	//optimization: the framebuffer comes from the run's WB_ONION arena instead of a new mapping every frame
+	unsigned width = arena.width(), height = arena.height();
+	Vec3f* image = arena.beginFrame();
+	int ret;
 
 
 	uint64_t threadContextSize = CONTEXT_SIZE; //amount of allocated data per thread
 	SceUltUlthread threads[NUM_THREADS];
-	attributes args[NUM_THREADS] __attribute__((aligned(8)));
+	attributes* args = reinterpret_cast<attributes*>(arena.allocateScratch(sizeof(attributes) * NUM_THREADS, 8));
 	//create user level threads
 	for (int i = 0; i < NUM_THREADS; i++) {
 
 		//setup arguments for the entry function
-		args[i].spheres = &spheres;
+		args[i].scene = &scene;
 		args[i].image = image;
 		args[i].iteration = iteration;
 		args[i].maxSubdivisions = NUM_THREADS;
@@ -388,10 +565,19 @@ int main(int argc, char** argv)
 		void* runtimeBuffer = malloc(workAreasize);
 		uint64_t ret = sceUltUlthreadRuntimeCreate(&runtime, "renderRuntime", concurrency, NUM_THREADS, runtimeBuffer, NULL);
 
+		//flat render scene (geometry, material table, lights), compiled once per frame before the threads are created
+		CompiledScene scene;
+
+		//direct memory for the framebuffers of all the frames, mapped once
+		FrameArena arena;
+		ret = arena.initialize(1920, 1080);
+		assert(ret == SCE_OK);
+
 		for (int i = 0; i < 10; i++)
 		{
 			Sphere* sphere4 = new (spherePool) Sphere(Vec3f(i, 0, -20), 1, Vec3f(1.00, 0.32, 0.36), 1, 0.5);
-			BasicRender(i, spherePool->objects, concurrency, runtime);
+			scene.Compile(spherePool->objects);
+			BasicRender(i, scene, concurrency, runtime, arena);
 			spherePool->ReleaseLast();
 		}
 
@@ -399,6 +585,8 @@ int main(int argc, char** argv)
 
 		sceUltUlthreadRuntimeDestroy(&runtime);
 		free(runtimeBuffer);
+		arena.terminate();
+		arena.printStatistics();
 
 		auto finish = std::chrono::steady_clock::now();
 		double elapsedSeconds = std::chrono::duration_cast<std::chrono::duration<double>>(finish - start).count();
@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#if defined __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#elif defined _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+//[comment]
+// Thread placement helpers for the render workers. A pinned worker stays on one core, so the
+// memory it touched first (and the OS placed on that core's NUMA node) stays local to it.
+// Platforms without the calls report failure / node 0 and the renderer runs unpinned.
+//[/comment]
+
+//[comment]
+// Logical processors the process may run on, in ascending order: its affinity mask, which can be
+// smaller than the machine (taskset, cgroups, a job object). On Windows these are processor
+// numbers within the process's processor group. Empty if the platform can't tell.
+//[/comment]
+inline std::vector<int> AllowedCpus()
+{
+	std::vector<int> cpus;
+#if defined __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) != 0) return cpus;
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+	}
+#elif defined _WIN32
+	DWORD_PTR processMask = 0, systemMask = 0;
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) return cpus;
+	for (int cpu = 0; cpu < (int)(sizeof(DWORD_PTR) * 8); ++cpu) {
+		if (processMask & ((DWORD_PTR)1 << cpu)) cpus.push_back(cpu);
+	}
+#endif
+	return cpus;
+}
+
+//pins the calling thread to one logical processor (one of AllowedCpus), false if that isn't supported or cpu is out of range
+inline bool PinThisThread(int cpu)
+{
+#if defined __linux__
+	if (cpu < 0 || cpu >= CPU_SETSIZE) return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined _WIN32
+	//an affinity mask only covers the thread's processor group, at most one bit per DWORD_PTR bit
+	if (cpu < 0 || cpu >= (int)(sizeof(DWORD_PTR) * 8)) return false;
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#else
+	return false;
+#endif
+}
+
+//NUMA node of the processor the calling thread is running on, 0 if it can't be told
+inline int CurrentNumaNode()
+{
+#if defined __linux__ && defined SYS_getcpu
+	unsigned cpu = 0, node = 0;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return 0;
+	return (int)node;
+#elif defined _WIN32
+	PROCESSOR_NUMBER processor;
+	GetCurrentProcessorNumberEx(&processor);
+	USHORT node = 0;
+	if (!GetNumaProcessorNodeEx(&processor, &node)) return 0;
+	return (int)node;
+#else
+	return 0;
+#endif
+}
+
+//[comment]
+// Work done on each NUMA node, to check that pinning and first touch placement pay off: a node
+// whose workers write remote memory shows a lower pixel rate than the others.
+//[/comment]
+#define MAX_NUMA_NODES 8
+struct NodeCounters
+{
+	std::atomic<unsigned long long> pixels[MAX_NUMA_NODES];
+	std::atomic<unsigned long long> microseconds[MAX_NUMA_NODES];
+
+	NodeCounters() { Clear(); }
+	void Clear()
+	{
+		for (int i = 0; i < MAX_NUMA_NODES; ++i) pixels[i] = 0, microseconds[i] = 0;
+	}
+	void Add(int node, unsigned long long nodePixels, unsigned long long nodeMicroseconds)
+	{
+		node = node < MAX_NUMA_NODES ? node : MAX_NUMA_NODES - 1;
+		pixels[node] += nodePixels;
+		microseconds[node] += nodeMicroseconds;
+	}
+};
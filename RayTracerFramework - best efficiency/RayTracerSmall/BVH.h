@@ -0,0 +1,490 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <cassert>
+#include "Sphere.h"
+#include "SphereSoA.h"
+#include "RayPacket.h"
+
+//[comment]
+// SAH tuning values. A leaf is always a single SIMD block of up to SIMD_WIDTH spheres, so the
+// intersection cost is counted per block rather than per sphere.
+//[/comment]
+#define BVH_BINS 12
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_BLOCK_COST 2.0f
+#define BVH_STACK_SIZE 64
+//[comment]
+// Deepest level the SAH splits are used at. The SAH may split one bin off per level, so a skewed
+// scene could otherwise grow deeper than the traversal stacks (a leaf at depth d needs d + 1 stack
+// entries). Below this depth nodes are split at the object median, which halves them every level
+// and so adds at most 31 more levels for any int count of spheres.
+//[/comment]
+#define BVH_MAX_SAH_DEPTH (BVH_STACK_SIZE - 1 - 31)
+//a refitted tree is rebuilt once its SAH cost grows past this multiple of the cost it was built with
+#define BVH_REBUILD_THRESHOLD 1.3f
+
+inline float GetAxis(const Vec3f& v, int axis) { return axis == 0 ? v.x : (axis == 1 ? v.y : v.z); }
+
+struct AABB
+{
+	Vec3f boundsMin, boundsMax;
+	AABB() : boundsMin(FLT_MAX), boundsMax(-FLT_MAX) {}
+	void Grow(const Vec3f& p)
+	{
+		boundsMin = Vec3f(std::min(boundsMin.x, p.x), std::min(boundsMin.y, p.y), std::min(boundsMin.z, p.z));
+		boundsMax = Vec3f(std::max(boundsMax.x, p.x), std::max(boundsMax.y, p.y), std::max(boundsMax.z, p.z));
+	}
+	void Grow(const AABB& b)
+	{
+		if (b.Empty()) return;
+		Grow(b.boundsMin);
+		Grow(b.boundsMax);
+	}
+	bool Empty() const { return boundsMin.x > boundsMax.x; }
+	bool Equals(const AABB& b) const
+	{
+		return boundsMin.x == b.boundsMin.x && boundsMin.y == b.boundsMin.y && boundsMin.z == b.boundsMin.z &&
+			boundsMax.x == b.boundsMax.x && boundsMax.y == b.boundsMax.y && boundsMax.z == b.boundsMax.z;
+	}
+	Vec3f Center() const { return (boundsMin + boundsMax) * 0.5f; }
+	float SurfaceArea() const
+	{
+		if (Empty()) return 0;
+		Vec3f e = boundsMax - boundsMin;
+		return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+};
+
+//[comment]
+// Box around a sphere. It is inflated slightly so float rounding in the sphere test can never
+// produce a hit point just outside the box that the traversal would have culled.
+//[/comment]
+inline AABB SphereBounds(const Sphere& sphere)
+{
+	AABB b;
+	float r = sphere.radius * (1 + 1e-4f) + 1e-4f;
+	b.boundsMin = sphere.center - Vec3f(r);
+	b.boundsMax = sphere.center + Vec3f(r);
+	return b;
+}
+
+struct BVHNode
+{
+	AABB bounds;
+	int leftFirst; //inner node: index of the left child (the right child follows it). leaf: first slot in the leaf SoA
+	int count;     //number of spheres in a leaf, 0 for inner nodes
+	int parent;    //-1 for the root
+	bool IsLeaf() const { return count > 0; }
+};
+
+//[comment]
+// Bounding volume hierarchy over the spheres of a MemoryPool, built with the binned surface area
+// heuristic. The leaves hold up to SIMD_WIDTH spheres, stored as one aligned block of a SphereSoA,
+// so every leaf visit is a single SIMD intersection. The queries return slot indices into that
+// SoA; GetSphere turns a slot back into the Sphere with the material data.
+// When a single sphere moves or changes size, Refit updates the bounds from its leaf up to the
+// root instead of rebuilding. The SAH cost of the tree is tracked incrementally while refitting,
+// and NeedsRebuild reports when the tree has degraded too far compared to a fresh build.
+//[/comment]
+class BVH
+{
+private:
+	struct BuildRef
+	{
+		AABB bounds;
+		Vec3f centroid;
+		const Sphere* sphere;
+		int objectIndex;
+	};
+	std::vector<BVHNode> m_nodes;
+	std::vector<BuildRef> m_refs;
+	SphereSoA m_leaves;
+	std::vector<int> m_objectSlot; //pool index -> leaf slot, -1 for empty pool slots
+	std::vector<int> m_slotNode;   //leaf slot -> leaf node
+	std::vector<int> m_slotObject; //leaf slot -> pool index, -1 for empty lanes
+	double m_weightedArea;         //sum of node cost * node area, the SAH cost before dividing by the root area
+	float m_buildCost;
+	int m_refitCount;
+	int m_rebuildCount;
+
+	static int Blocks(int count) { return (count + SIMD_WIDTH - 1) / SIMD_WIDTH; }
+	static float NodeCost(const BVHNode& node) { return node.IsLeaf() ? BVH_BLOCK_COST : BVH_TRAVERSAL_COST; }
+
+	//replaces the bounds of a node and keeps the SAH cost up to date
+	void SetBounds(int nodeIndex, const AABB& bounds)
+	{
+		BVHNode& node = m_nodes[nodeIndex];
+		m_weightedArea += NodeCost(node) * (bounds.SurfaceArea() - node.bounds.SurfaceArea());
+		node.bounds = bounds;
+	}
+
+	//slab test, returns the distance the ray enters the box through tentry
+	static bool IntersectAABB(const AABB& b, const Vec3f& rayorig, const Vec3f& invDir, float tnear, float& tentry)
+	{
+		float tx1 = (b.boundsMin.x - rayorig.x) * invDir.x, tx2 = (b.boundsMax.x - rayorig.x) * invDir.x;
+		float tmin = std::min(tx1, tx2), tmax = std::max(tx1, tx2);
+		float ty1 = (b.boundsMin.y - rayorig.y) * invDir.y, ty2 = (b.boundsMax.y - rayorig.y) * invDir.y;
+		tmin = std::max(tmin, std::min(ty1, ty2)), tmax = std::min(tmax, std::max(ty1, ty2));
+		float tz1 = (b.boundsMin.z - rayorig.z) * invDir.z, tz2 = (b.boundsMax.z - rayorig.z) * invDir.z;
+		tmin = std::max(tmin, std::min(tz1, tz2)), tmax = std::min(tmax, std::max(tz1, tz2));
+		tentry = tmin;
+		return tmax >= tmin && tmax >= 0 && tmin < tnear;
+	}
+
+	//true if at least one ray of the packet enters the box closer than its current hit
+	static bool IntersectAABBPacket(const AABB& b, const RayPacket& packet, const float* invX, const float* invY, const float* invZ, const float* tnear)
+	{
+		SimdFloat minX = SimdSet(b.boundsMin.x - packet.origin.x), maxX = SimdSet(b.boundsMax.x - packet.origin.x);
+		SimdFloat minY = SimdSet(b.boundsMin.y - packet.origin.y), maxY = SimdSet(b.boundsMax.y - packet.origin.y);
+		SimdFloat minZ = SimdSet(b.boundsMin.z - packet.origin.z), maxZ = SimdSet(b.boundsMax.z - packet.origin.z);
+		SimdFloat zero = SimdSet(0);
+		for (int i = 0; i < PACKET_SIZE; i += SIMD_WIDTH) {
+			SimdFloat ix = SimdLoad(invX + i), iy = SimdLoad(invY + i), iz = SimdLoad(invZ + i);
+			SimdFloat tx1 = SimdMul(minX, ix), tx2 = SimdMul(maxX, ix);
+			SimdFloat ty1 = SimdMul(minY, iy), ty2 = SimdMul(maxY, iy);
+			SimdFloat tz1 = SimdMul(minZ, iz), tz2 = SimdMul(maxZ, iz);
+			SimdFloat tmin = SimdMax(SimdMax(SimdMin(tx1, tx2), SimdMin(ty1, ty2)), SimdMin(tz1, tz2));
+			SimdFloat tmax = SimdMin(SimdMin(SimdMax(tx1, tx2), SimdMax(ty1, ty2)), SimdMax(tz1, tz2));
+			SimdFloat hit = SimdAnd(SimdGreaterEqual(tmax, SimdMax(tmin, zero)), SimdLess(tmin, SimdLoad(tnear + i)));
+			if (SimdMoveMask(hit) != 0) return true;
+		}
+		return false;
+	}
+
+	//depth is the level of the node, 0 for the root
+	void Subdivide(int nodeIndex, int begin, int end, int depth)
+	{
+		assert(depth < BVH_STACK_SIZE); //see BVH_MAX_SAH_DEPTH
+		int count = end - begin;
+		AABB bounds, centroidBounds;
+		for (int i = begin; i < end; ++i) {
+			bounds.Grow(m_refs[i].bounds);
+			centroidBounds.Grow(m_refs[i].centroid);
+		}
+		m_nodes[nodeIndex].bounds = bounds;
+		m_nodes[nodeIndex].leftFirst = begin;
+		m_nodes[nodeIndex].count = count;
+		if (count == 1) return;
+		if (depth >= BVH_MAX_SAH_DEPTH) {
+			SubdivideMedian(nodeIndex, begin, end, depth, centroidBounds);
+			return;
+		}
+
+		//find the cheapest binned split over all three axes
+		float bestCost = FLT_MAX;
+		int bestAxis = -1, bestSplit = 0;
+		for (int axis = 0; axis < 3; ++axis) {
+			float axisMin = GetAxis(centroidBounds.boundsMin, axis);
+			float extent = GetAxis(centroidBounds.boundsMax, axis) - axisMin;
+			if (extent <= 0) continue;
+
+			AABB binBounds[BVH_BINS];
+			int binCount[BVH_BINS] = { 0 };
+			float scale = BVH_BINS / extent;
+			for (int i = begin; i < end; ++i) {
+				int bin = std::min(BVH_BINS - 1, (int)((GetAxis(m_refs[i].centroid, axis) - axisMin) * scale));
+				binBounds[bin].Grow(m_refs[i].bounds);
+				binCount[bin]++;
+			}
+
+			//sweep from the right to get the area and count on the right of every split plane
+			float rightArea[BVH_BINS];
+			int rightCount[BVH_BINS];
+			AABB rightBox;
+			int rightSum = 0;
+			for (int i = BVH_BINS - 1; i > 0; --i) {
+				rightBox.Grow(binBounds[i]);
+				rightSum += binCount[i];
+				rightArea[i] = rightBox.SurfaceArea();
+				rightCount[i] = rightSum;
+			}
+			AABB leftBox;
+			int leftSum = 0;
+			for (int i = 1; i < BVH_BINS; ++i) {
+				leftBox.Grow(binBounds[i - 1]);
+				leftSum += binCount[i - 1];
+				if (leftSum == 0 || rightCount[i] == 0) continue;
+				float cost = leftBox.SurfaceArea() * Blocks(leftSum) + rightArea[i] * Blocks(rightCount[i]);
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = i;
+				}
+			}
+		}
+
+		int mid = begin;
+		if (bestAxis >= 0) {
+			float area = bounds.SurfaceArea();
+			bestCost = BVH_TRAVERSAL_COST + (area > 0 ? bestCost / area : 0) * BVH_BLOCK_COST;
+			//a leaf can only hold one SIMD block, bigger nodes have to be split even if SAH disagrees
+			if (count <= SIMD_WIDTH && BVH_BLOCK_COST <= bestCost) return;
+
+			float axisMin = GetAxis(centroidBounds.boundsMin, bestAxis);
+			float scale = BVH_BINS / (GetAxis(centroidBounds.boundsMax, bestAxis) - axisMin);
+			BuildRef* split = std::partition(m_refs.data() + begin, m_refs.data() + end, [&](const BuildRef& ref) {
+				return std::min(BVH_BINS - 1, (int)((GetAxis(ref.centroid, bestAxis) - axisMin) * scale)) < bestSplit;
+			});
+			mid = (int)(split - m_refs.data());
+		}
+		else if (count <= SIMD_WIDTH) {
+			return; //every centroid is in the same place, nothing to split
+		}
+		//fall back to a median split when the binning could not separate the spheres
+		if (mid == begin || mid == end) mid = begin + count / 2;
+		Split(nodeIndex, begin, mid, end, depth);
+	}
+
+	//[comment]
+	// Split used below BVH_MAX_SAH_DEPTH: the spheres are halved at the median centroid along the
+	// widest axis, a node that fits a SIMD block becomes a leaf.
+	//[/comment]
+	void SubdivideMedian(int nodeIndex, int begin, int end, int depth, const AABB& centroidBounds)
+	{
+		if (end - begin <= SIMD_WIDTH) return;
+		Vec3f extent = centroidBounds.boundsMax - centroidBounds.boundsMin;
+		int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+		int mid = begin + (end - begin) / 2;
+		std::nth_element(m_refs.data() + begin, m_refs.data() + mid, m_refs.data() + end, [axis](const BuildRef& a, const BuildRef& b) {
+			return GetAxis(a.centroid, axis) < GetAxis(b.centroid, axis);
+		});
+		Split(nodeIndex, begin, mid, end, depth);
+	}
+
+	//turns the node into an inner node with the refs [begin, mid) on the left and [mid, end) on the right
+	void Split(int nodeIndex, int begin, int mid, int end, int depth)
+	{
+		int left = (int)m_nodes.size();
+		m_nodes.push_back(BVHNode());
+		m_nodes.push_back(BVHNode());
+		m_nodes[nodeIndex].leftFirst = left;
+		m_nodes[nodeIndex].count = 0;
+		m_nodes[left].parent = nodeIndex;
+		m_nodes[left + 1].parent = nodeIndex;
+		Subdivide(left, begin, mid, depth + 1);
+		Subdivide(left + 1, mid, end, depth + 1);
+	}
+
+public:
+	BVH() : m_weightedArea(0), m_buildCost(0), m_refitCount(0), m_rebuildCount(0) {}
+
+	//[comment]
+	// Builds the tree from the live objects of a pool (empty slots are skipped). With liveSlots only
+	// those slots are visited (see MemoryPool::GetLiveSlots), so a big pool with few live objects
+	// isn't scanned slot by slot.
+	//[/comment]
+	void Build(const std::vector<Sphere*>& objects, const std::vector<int>* liveSlots = nullptr)
+	{
+		m_rebuildCount++;
+		m_refs.clear();
+		int liveCount = liveSlots ? (int)liveSlots->size() : (int)objects.size();
+		for (int n = 0; n < liveCount; ++n) {
+			int i = liveSlots ? (*liveSlots)[n] : n;
+			if (objects[i] == nullptr) continue;
+			BuildRef ref;
+			ref.bounds = SphereBounds(*objects[i]);
+			ref.centroid = ref.bounds.Center();
+			ref.sphere = objects[i];
+			ref.objectIndex = i;
+			m_refs.push_back(ref);
+		}
+		m_nodes.clear();
+		m_objectSlot.assign(objects.size(), -1);
+		m_weightedArea = 0;
+		m_buildCost = 0;
+		if (m_refs.empty()) {
+			m_leaves.Resize(0);
+			m_slotNode.clear();
+			m_slotObject.clear();
+			return;
+		}
+		m_nodes.reserve(m_refs.size() * 2);
+		m_nodes.push_back(BVHNode());
+		m_nodes[0].parent = -1;
+		Subdivide(0, 0, (int)m_refs.size(), 0);
+
+		//give every leaf its own SIMD block in the SoA, the unused lanes stay empty
+		int leafCount = 0;
+		for (unsigned i = 0; i < m_nodes.size(); ++i) {
+			if (m_nodes[i].IsLeaf()) leafCount++;
+		}
+		m_leaves.Resize(leafCount * SIMD_WIDTH);
+		m_slotNode.assign(leafCount * SIMD_WIDTH, -1);
+		m_slotObject.assign(leafCount * SIMD_WIDTH, -1);
+		int slot = 0;
+		for (unsigned i = 0; i < m_nodes.size(); ++i) {
+			BVHNode& node = m_nodes[i];
+			m_weightedArea += NodeCost(node) * node.bounds.SurfaceArea();
+			if (!node.IsLeaf()) continue;
+			for (int j = 0; j < node.count; ++j) {
+				const BuildRef& ref = m_refs[node.leftFirst + j];
+				m_leaves.Set(slot + j, ref.sphere);
+				m_objectSlot[ref.objectIndex] = slot + j;
+				m_slotNode[slot + j] = i;
+				m_slotObject[slot + j] = ref.objectIndex;
+			}
+			node.leftFirst = slot;
+			slot += SIMD_WIDTH;
+		}
+		m_buildCost = Cost();
+	}
+
+	//[comment]
+	// Updates the tree after the sphere at objectIndex in the pool moved or changed radius. Only the
+	// leaf holding it and the nodes on the path to the root are touched, and the walk stops early
+	// once a node's bounds come out unchanged. Returns false if the sphere is not in the tree
+	// (it was added or removed since the last Build), in which case the caller has to rebuild.
+	//[/comment]
+	bool Refit(const std::vector<Sphere*>& objects, int objectIndex)
+	{
+		if (objectIndex < 0 || objectIndex >= (int)m_objectSlot.size()) return false;
+		int slot = m_objectSlot[objectIndex];
+		if (slot < 0 || objects[objectIndex] == nullptr) return false;
+		m_refitCount++;
+		m_leaves.Set(slot, objects[objectIndex]);
+
+		int nodeIndex = m_slotNode[slot];
+		const BVHNode& leaf = m_nodes[nodeIndex];
+		AABB bounds;
+		for (int i = 0; i < leaf.count; ++i) {
+			bounds.Grow(SphereBounds(*m_leaves.spheres[leaf.leftFirst + i]));
+		}
+		SetBounds(nodeIndex, bounds);
+
+		nodeIndex = leaf.parent;
+		while (nodeIndex >= 0) {
+			const BVHNode& node = m_nodes[nodeIndex];
+			AABB merged = m_nodes[node.leftFirst].bounds;
+			merged.Grow(m_nodes[node.leftFirst + 1].bounds);
+			if (merged.Equals(node.bounds)) break;
+			SetBounds(nodeIndex, merged);
+			nodeIndex = node.parent;
+		}
+		return true;
+	}
+
+	//SAH cost of the current tree, relative to the area of the root
+	float Cost() const
+	{
+		if (m_nodes.empty()) return 0;
+		float rootArea = m_nodes[0].bounds.SurfaceArea();
+		return rootArea > 0 ? (float)(m_weightedArea / rootArea) : 0;
+	}
+	bool NeedsRebuild() const { return Cost() > m_buildCost * BVH_REBUILD_THRESHOLD; }
+	int GetRefitCount() const { return m_refitCount; }
+	int GetRebuildCount() const { return m_rebuildCount; }
+
+	int SlotCount() const { return m_leaves.count(); }
+	int NodeCount() const { return (int)m_nodes.size(); }
+	const Sphere* GetSphere(int slot) const { return m_leaves.spheres[slot]; }
+	//leaf slot of the object at objectIndex in the pool, -1 if it is not in the tree
+	int GetSlot(int objectIndex) const
+	{
+		return objectIndex >= 0 && objectIndex < (int)m_objectSlot.size() ? m_objectSlot[objectIndex] : -1;
+	}
+	//pool index of the object in a leaf slot, -1 for an empty lane
+	int GetObjectIndex(int slot) const { return m_slotObject[slot]; }
+
+	//[comment]
+	// Closest-hit traversal. Children are visited front to back and any node that starts
+	// further away than the current closest hit is skipped.
+	//[/comment]
+	bool Intersect(const Vec3f& rayorig, const Vec3f& raydir, float& tnear, int& index) const
+	{
+		if (m_nodes.empty()) return false;
+		Vec3f invDir(1 / raydir.x, 1 / raydir.y, 1 / raydir.z);
+		int stack[BVH_STACK_SIZE];
+		float stackEntry[BVH_STACK_SIZE];
+		int stackSize = 0;
+		bool found = false;
+
+		float tentry;
+		if (!IntersectAABB(m_nodes[0].bounds, rayorig, invDir, tnear, tentry)) return false;
+		stack[stackSize] = 0, stackEntry[stackSize++] = tentry;
+		while (stackSize > 0) {
+			--stackSize;
+			if (stackEntry[stackSize] >= tnear) continue;
+			const BVHNode& node = m_nodes[stack[stackSize]];
+			if (node.IsLeaf()) {
+				if (m_leaves.IntersectRange(rayorig, raydir, node.leftFirst, node.leftFirst + node.count, tnear, index)) found = true;
+				continue;
+			}
+			float tleft, tright;
+			bool hitLeft = IntersectAABB(m_nodes[node.leftFirst].bounds, rayorig, invDir, tnear, tleft);
+			bool hitRight = IntersectAABB(m_nodes[node.leftFirst + 1].bounds, rayorig, invDir, tnear, tright);
+			//push the far child first so the near one is popped next
+			if (hitLeft && hitRight && tleft < tright) {
+				stack[stackSize] = node.leftFirst + 1, stackEntry[stackSize++] = tright;
+				hitRight = false;
+			}
+			if (hitLeft) stack[stackSize] = node.leftFirst, stackEntry[stackSize++] = tleft;
+			if (hitRight) stack[stackSize] = node.leftFirst + 1, stackEntry[stackSize++] = tright;
+		}
+		return found;
+	}
+
+	//[comment]
+	// Closest-hit traversal for a packet of rays. A node is entered if any ray of the packet
+	// hits its box; the leaves use the per-sphere broadcast kernel of SphereSoA.
+	//[/comment]
+	void IntersectPacket(const RayPacket& packet, float* tnear, int* index) const
+	{
+		if (m_nodes.empty()) return;
+		alignas(32) float invX[PACKET_SIZE];
+		alignas(32) float invY[PACKET_SIZE];
+		alignas(32) float invZ[PACKET_SIZE];
+		for (int i = 0; i < PACKET_SIZE; ++i) {
+			invX[i] = 1 / packet.dirX[i];
+			invY[i] = 1 / packet.dirY[i];
+			invZ[i] = 1 / packet.dirZ[i];
+		}
+		Vec3f leadDir = packet.GetDirection(0);
+
+		int stack[BVH_STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = 0;
+		while (stackSize > 0) {
+			const BVHNode& node = m_nodes[stack[--stackSize]];
+			if (!IntersectAABBPacket(node.bounds, packet, invX, invY, invZ, tnear)) continue;
+			if (node.IsLeaf()) {
+				m_leaves.IntersectPacketRange(packet, node.leftFirst, node.leftFirst + node.count, tnear, index);
+				continue;
+			}
+			//the rays are coherent, so order the children along the first ray of the packet
+			const BVHNode& left = m_nodes[node.leftFirst];
+			const BVHNode& right = m_nodes[node.leftFirst + 1];
+			bool leftFirst = (left.bounds.Center() - right.bounds.Center()).dot(leadDir) < 0;
+			stack[stackSize++] = leftFirst ? node.leftFirst + 1 : node.leftFirst;
+			stack[stackSize++] = leftFirst ? node.leftFirst : node.leftFirst + 1;
+		}
+	}
+
+	//[comment]
+	// Any-hit traversal for shadow rays, returns as soon as a leaf reports a blocker closer than
+	// tmax (the distance to the light). Nodes that start beyond tmax are skipped.
+	// skipIndex is the slot of the light the ray is aimed at, blocker (if given) receives the slot
+	// of the sphere that was found blocking the ray.
+	//[/comment]
+	bool Occluded(const Vec3f& rayorig, const Vec3f& raydir, float tmax, int skipIndex, int* blocker = nullptr) const
+	{
+		if (m_nodes.empty()) return false;
+		Vec3f invDir(1 / raydir.x, 1 / raydir.y, 1 / raydir.z);
+		int stack[BVH_STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = 0;
+		float tentry;
+		while (stackSize > 0) {
+			const BVHNode& node = m_nodes[stack[--stackSize]];
+			if (!IntersectAABB(node.bounds, rayorig, invDir, tmax, tentry)) continue;
+			if (node.IsLeaf()) {
+				if (m_leaves.OccludedRange(rayorig, raydir, tmax, node.leftFirst, node.leftFirst + node.count, skipIndex, blocker)) return true;
+				continue;
+			}
+			stack[stackSize++] = node.leftFirst + 1;
+			stack[stackSize++] = node.leftFirst;
+		}
+		return false;
+	}
+};
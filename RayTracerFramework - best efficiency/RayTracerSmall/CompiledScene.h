@@ -0,0 +1,248 @@
+#pragma once
+#include <vector>
+#include <cfloat>
+#include "BVH.h"
+#include "MemoryPool.h"
+
+//[comment]
+// Which secondary rays a surface spawns. The specialised shading kernels are instantiated once per
+// class, so the transparency and reflection tests are resolved at compile time.
+//[/comment]
+enum MaterialClass
+{
+	MATERIAL_DIFFUSE,		//no secondary rays, lit by the lights
+	MATERIAL_REFLECTIVE,	//reflection ray only
+	MATERIAL_REFRACTIVE,	//refraction ray only
+	MATERIAL_GLASS,			//reflection and refraction rays
+	MATERIAL_CLASS_COUNT
+};
+
+inline MaterialClass ClassifyMaterial(float transparency, float reflection)
+{
+	bool transparent = transparency > 0;
+	bool reflective = reflection > 0;
+	if (transparent && reflective) return MATERIAL_GLASS;
+	if (transparent) return MATERIAL_REFRACTIVE;
+	if (reflective) return MATERIAL_REFLECTIVE;
+	return MATERIAL_DIFFUSE;
+}
+
+//surface properties of a sphere, copied out of the Sphere objects so shading never touches the pool
+struct Material
+{
+	Vec3f surfaceColor, emissionColor;
+	float transparency, reflection;
+	MaterialClass materialClass;
+};
+
+//an emissive sphere, gathered once per frame so the diffuse shading loop doesn't rescan the scene
+struct Light
+{
+	Vec3f center, emissionColor;
+	int slot; //BVH slot of the light, its own shadow rays never count it as a blocker
+};
+
+//[comment]
+// Immutable render scene, compiled once per frame on the main thread before the render threads
+// start and then only read through a const reference. It holds the BVH (whose leaves are the
+// contiguous SoA geometry), a material table and sphere centres indexed by the same BVH slot,
+// the list of lights, and the slots bucketed by material class. HasLights lets the diffuse shading
+// skip the light loop entirely.
+// With static flags (see MemoryPool::SetStatic) the scene is also split in two: the static spheres
+// get a BVH of their own, which is only rebuilt when one of them changes, and the dynamic spheres
+// are copied into a small SoA every frame that is tested by brute force. IntersectStatic plus
+// IntersectDynamic give the same closest hit as Intersect.
+//[/comment]
+class CompiledScene
+{
+private:
+	BVH m_bvh;
+	std::vector<Vec3f> m_centers;
+	std::vector<float> m_radius2;
+	std::vector<Material> m_materials;
+	std::vector<Light> m_lights;
+	std::vector<int> m_classSlots[MATERIAL_CLASS_COUNT]; //BVH slots of the spheres of each material class
+	BVH m_staticBVH;
+	SphereSoA m_dynamic;
+	std::vector<char> m_staticFlags;    //pool index -> static, as of the last static build
+	std::vector<int> m_staticLive;      //pool indices of the live static spheres
+	std::vector<int> m_staticSlots;     //static BVH slot -> BVH slot
+	std::vector<int> m_dynamicSlots;    //m_dynamic slot -> BVH slot
+	int m_staticBuildCount;
+	int m_geometryVersion;
+	float m_radianceBound;
+
+	bool IsStaticObject(int objectIndex) const
+	{
+		return objectIndex < (int)m_staticFlags.size() && m_staticFlags[objectIndex];
+	}
+	//[comment]
+	// Rebuilds the static BVH if the static set changed or one of the static spheres moved.
+	// Without flags every sphere is dynamic.
+	//[/comment]
+	void UpdateStatic(const std::vector<Sphere*>& objects, const std::vector<char>* staticFlags, const std::vector<int>* liveSlots, bool staticMoved)
+	{
+		static const std::vector<char> noFlags;
+		const std::vector<char>& flags = staticFlags ? *staticFlags : noFlags;
+		if (!staticMoved && flags == m_staticFlags) return;
+		m_staticFlags = flags;
+		m_staticLive.clear();
+		int liveCount = liveSlots ? (int)liveSlots->size() : (int)objects.size();
+		for (int n = 0; n < liveCount; ++n) {
+			int i = liveSlots ? (*liveSlots)[n] : n;
+			if (objects[i] != nullptr && IsStaticObject(i)) m_staticLive.push_back(i);
+		}
+		m_staticBVH.Build(objects, &m_staticLive);
+		m_staticBuildCount++;
+	}
+
+	//refreshes the per slot tables after the BVH has been built or refitted
+	void Gather()
+	{
+		int slots = m_bvh.SlotCount();
+		m_centers.resize(slots);
+		m_radius2.resize(slots);
+		m_materials.resize(slots);
+		m_lights.clear();
+		for (std::vector<int>& bucket : m_classSlots) bucket.clear();
+		m_staticSlots.assign(m_staticBVH.SlotCount(), -1);
+		m_dynamicSlots.clear();
+		for (int i = 0; i < slots; ++i) {
+			const Sphere* sphere = m_bvh.GetSphere(i);
+			if (sphere == nullptr) continue;
+			int objectIndex = m_bvh.GetObjectIndex(i);
+			if (IsStaticObject(objectIndex)) m_staticSlots[m_staticBVH.GetSlot(objectIndex)] = i;
+			else m_dynamicSlots.push_back(i);
+			m_centers[i] = sphere->center;
+			m_radius2[i] = sphere->radius2;
+			Material& material = m_materials[i];
+			material.surfaceColor = sphere->surfaceColor;
+			material.emissionColor = sphere->emissionColor;
+			material.transparency = sphere->transparency;
+			material.reflection = sphere->reflection;
+			material.materialClass = ClassifyMaterial(sphere->transparency, sphere->reflection);
+			m_classSlots[material.materialClass].push_back(i);
+			if (sphere->emissionColor.x > 0) {
+				Light light;
+				light.center = sphere->center;
+				light.emissionColor = sphere->emissionColor;
+				light.slot = i;
+				m_lights.push_back(light);
+			}
+		}
+		m_dynamic.Resize((int)m_dynamicSlots.size());
+		for (unsigned i = 0; i < m_dynamicSlots.size(); ++i) m_dynamic.Set(i, m_bvh.GetSphere(m_dynamicSlots[i]));
+		UpdateRadianceBound();
+	}
+
+	//[comment]
+	// Bound for the colour (largest component) a ray can bring back. A miss gives the background 2,
+	// a diffuse hit at most E + S * L and a bouncing hit at most E + S * (what its rays bring back),
+	// with E the brightest emission, S the largest surface colour (times the transparency if that is
+	// above 1) and L the summed light emission. Any depth stays below max(2, E + S * L, E / (1 - S))
+	// for S < 1, and below max(2, L) for S = 1 without emission. Otherwise FLT_MAX.
+	//[/comment]
+	void UpdateRadianceBound()
+	{
+		float emission = 0, surface = 0, lights = 0;
+		for (const Material& material : m_materials) {
+			const Vec3f& e = material.emissionColor;
+			const Vec3f& c = material.surfaceColor;
+			emission = std::max(emission, std::max(e.x, std::max(e.y, e.z)));
+			surface = std::max(surface, std::max(c.x, std::max(c.y, c.z)) * std::max(1.0f, material.transparency));
+		}
+		for (const Light& light : m_lights) {
+			lights += std::max(light.emissionColor.x, std::max(light.emissionColor.y, light.emissionColor.z));
+		}
+		if (surface < 1) m_radianceBound = std::max(std::max(2.0f, emission + surface * lights), emission / (1 - surface));
+		else if (surface == 1 && emission == 0) m_radianceBound = std::max(2.0f, lights);
+		else m_radianceBound = FLT_MAX;
+	}
+public:
+	CompiledScene() : m_staticBuildCount(0), m_geometryVersion(0), m_radianceBound(FLT_MAX) {}
+
+	//[comment]
+	// Full build from the pool, empty slots are skipped. staticFlags has one flag per pool slot,
+	// liveSlots lists the slots to visit (all of them without it).
+	//[/comment]
+	void Compile(const std::vector<Sphere*>& objects, const std::vector<char>* staticFlags = nullptr, const std::vector<int>* liveSlots = nullptr)
+	{
+		UpdateStatic(objects, staticFlags, liveSlots, true);
+		m_bvh.Build(objects, liveSlots);
+		m_geometryVersion++;
+		Gather();
+	}
+	//[comment]
+	// Same result as Compile when only objects[changedIndex] changed since the last call. If its
+	// position and size are unchanged only the material tables are refreshed and the geometry
+	// version stays the same. Otherwise the BVH is refitted and only rebuilt from scratch when the
+	// refit has degraded it too much.
+	//[/comment]
+	void Update(const std::vector<Sphere*>& objects, int changedIndex, const std::vector<char>* staticFlags = nullptr, const std::vector<int>* liveSlots = nullptr)
+	{
+		bool moved = GeometryChanged(objects, changedIndex);
+		UpdateStatic(objects, staticFlags, liveSlots, moved && IsStaticObject(changedIndex));
+		if (moved) {
+			if (!m_bvh.Refit(objects, changedIndex) || m_bvh.NeedsRebuild()) {
+				m_bvh.Build(objects, liveSlots);
+			}
+			m_geometryVersion++;
+		}
+		Gather();
+	}
+	//the same for the live objects of a sphere pool and its static flags
+	void Compile(const MemoryPool<Sphere>& pool) { Compile(pool.objects, &pool.GetStaticFlags(), &pool.GetLiveSlots()); }
+	void Update(const MemoryPool<Sphere>& pool, int changedIndex) { Update(pool.objects, changedIndex, &pool.GetStaticFlags(), &pool.GetLiveSlots()); }
+	//false if objects[changedIndex] is in the tree with the same centre and radius as at the last update
+	bool GeometryChanged(const std::vector<Sphere*>& objects, int changedIndex) const
+	{
+		int slot = m_bvh.GetSlot(changedIndex);
+		if (slot < 0 || objects[changedIndex] == nullptr) return true;
+		const Sphere* sphere = objects[changedIndex];
+		const Vec3f& center = m_centers[slot];
+		return sphere->center.x != center.x || sphere->center.y != center.y || sphere->center.z != center.z ||
+			sphere->radius2 != m_radius2[slot];
+	}
+
+	const BVH& GetBVH() const { return m_bvh; }
+	const Vec3f& GetCenter(int slot) const { return m_centers[slot]; }
+	int GetSlot(int objectIndex) const { return m_bvh.GetSlot(objectIndex); }
+	const Material& GetMaterial(int slot) const { return m_materials[slot]; }
+	const std::vector<Light>& GetLights() const { return m_lights; }
+	bool HasLights() const { return !m_lights.empty(); }
+	//upper bound for the colour any ray of the scene can bring back, FLT_MAX if there is none (see UpdateRadianceBound)
+	float GetRadianceBound() const { return m_radianceBound; }
+	const std::vector<int>& GetClassSlots(MaterialClass materialClass) const { return m_classSlots[materialClass]; }
+	//goes up whenever a sphere moved, was added or was removed, anything cached about what the rays hit is stale then
+	int GetGeometryVersion() const { return m_geometryVersion; }
+	//goes up whenever the static BVH is rebuilt, anything cached about the static spheres is stale then
+	int GetStaticBuildCount() const { return m_staticBuildCount; }
+	//BVH slot of a static BVH slot
+	int GetStaticHitSlot(int staticSlot) const { return m_staticSlots[staticSlot]; }
+
+	bool Intersect(const Vec3f& rayorig, const Vec3f& raydir, float& tnear, int& index) const
+	{
+		return m_bvh.Intersect(rayorig, raydir, tnear, index);
+	}
+	void IntersectPacket(const RayPacket& packet, float* tnear, int* index) const
+	{
+		m_bvh.IntersectPacket(packet, tnear, index);
+	}
+	//closest hit among the static spheres, index is a static BVH slot
+	bool IntersectStatic(const Vec3f& rayorig, const Vec3f& raydir, float& tnear, int& index) const
+	{
+		return m_staticBVH.Intersect(rayorig, raydir, tnear, index);
+	}
+	//closest hit among the dynamic spheres that is nearer than tnear, index is a BVH slot
+	bool IntersectDynamic(const Vec3f& rayorig, const Vec3f& raydir, float& tnear, int& index) const
+	{
+		int dynamicIndex = -1;
+		if (!m_dynamic.Intersect(rayorig, raydir, tnear, dynamicIndex)) return false;
+		index = m_dynamicSlots[dynamicIndex];
+		return true;
+	}
+	bool Occluded(const Vec3f& rayorig, const Vec3f& raydir, float tmax, int skipIndex, int* blocker = nullptr) const
+	{
+		return m_bvh.Occluded(rayorig, raydir, tmax, skipIndex, blocker);
+	}
+};
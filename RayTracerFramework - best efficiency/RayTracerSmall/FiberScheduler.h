@@ -0,0 +1,228 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include "ThreadPool.h"
+#if defined _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <ucontext.h>
+#include <stdint.h>
+#endif
+
+//[comment]
+// Stack of every fiber. The renderer traces with an explicit ray stack, so a fiber only needs room
+// for a few frames of trace and shade plus whatever the job keeps on it.
+//[/comment]
+#define FIBER_STACK_SIZE (64 * 1024)
+
+//[comment]
+// Edge length of the square a render fiber job covers, a 1080p frame is cut into some 8000 jobs.
+// Fibers every worker has, so while one of its jobs yields the worker has others to run.
+//[/comment]
+#define FIBER_JOB_SIZE 16
+#define FIBERS_PER_WORKER 8
+
+//[comment]
+// User level threads for the render workers, the desktop counterpart of the sce ULT runtime of the
+// PlayStation version: a few OS threads (the workers of a ThreadPool) run many fibers, each with a
+// stack allocated once in the constructor. Jobs are queued with Add and taken by whichever worker
+// has a fiber free, so a frame can be cut into thousands of small jobs without a thread, a stack
+// or a context for each of them. A job can give its worker to the next fiber with YieldFiber.
+// Every worker owns its own fibers and a fiber never moves to another worker, which keeps the
+// thread_local state (the ray counters) of a job on one thread even across YieldFiber. Fibers run
+// on ucontext on Linux and on Windows fibers on Windows.
+// Run has to be called from outside the pool, it blocks until every job has finished.
+//[/comment]
+class FiberScheduler
+{
+private:
+	struct Worker;
+	struct Fiber
+	{
+		std::function<void()> job;
+		bool finished;
+		Worker* worker; //the worker that owns the fiber
+#if defined _WIN32
+		LPVOID context;
+#else
+		ucontext_t context;
+		std::vector<char> stack;
+#endif
+	};
+	struct Worker
+	{
+		std::vector<Fiber*> idle;  //fibers without a job
+		std::deque<Fiber*> ready;  //fibers with a job, run in turn
+#if defined _WIN32
+		LPVOID context;
+#else
+		ucontext_t context;
+#endif
+	};
+	std::vector<std::unique_ptr<Fiber>> m_fibers;
+	std::vector<Worker> m_workers;
+	std::deque<std::function<void()>> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_workersDone;
+	int m_runningWorkers;
+	unsigned long long m_jobsRun, m_switches;
+
+	static Fiber*& CurrentFiber()
+	{
+		static thread_local Fiber* current = nullptr;
+		return current;
+	}
+
+	//runs the jobs the worker hands the fiber, forever; the stack is only gone with the fiber
+	static void FiberMain(Fiber* fiber)
+	{
+		while (true) {
+			fiber->job();
+			fiber->job = nullptr;
+			fiber->finished = true;
+			SwitchToWorker(fiber);
+		}
+	}
+#if defined _WIN32
+	static void CALLBACK FiberEntry(void* fiber) { FiberMain((Fiber*)fiber); }
+#else
+	//makecontext only passes ints, the pointer is split into two halves
+	static void FiberEntry(unsigned int high, unsigned int low) { FiberMain((Fiber*)(uintptr_t)(((unsigned long long)high << 32) | low)); }
+#endif
+
+	static void SwitchToWorker(Fiber* fiber)
+	{
+#if defined _WIN32
+		::SwitchToFiber(fiber->worker->context);
+#else
+		swapcontext(&fiber->context, &fiber->worker->context);
+#endif
+	}
+	static void RunFiber(Worker& worker, Fiber* fiber)
+	{
+		CurrentFiber() = fiber;
+#if defined _WIN32
+		::SwitchToFiber(fiber->context);
+#else
+		swapcontext(&worker.context, &fiber->context);
+#endif
+		CurrentFiber() = nullptr;
+	}
+
+	bool TakeJob(std::function<void()>& job)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_jobs.empty()) return false;
+		job = std::move(m_jobs.front());
+		m_jobs.pop_front();
+		return true;
+	}
+
+	//round robin over the worker's fibers, a free fiber takes the next job, until no job is left
+	void WorkerLoop(Worker& worker)
+	{
+#if defined _WIN32
+		worker.context = ConvertThreadToFiber(nullptr);
+#endif
+		unsigned long long jobsRun = 0, switches = 0;
+		std::function<void()> job;
+		while (true) {
+			if (!worker.idle.empty() && TakeJob(job)) {
+				Fiber* fiber = worker.idle.back();
+				worker.idle.pop_back();
+				fiber->job = std::move(job);
+				fiber->finished = false;
+				worker.ready.push_back(fiber);
+				jobsRun++;
+			}
+			if (worker.ready.empty()) break;
+			Fiber* fiber = worker.ready.front();
+			worker.ready.pop_front();
+			RunFiber(worker, fiber);
+			switches++;
+			if (fiber->finished) worker.idle.push_back(fiber);
+			else worker.ready.push_back(fiber);
+		}
+#if defined _WIN32
+		ConvertFiberToThread();
+#endif
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobsRun += jobsRun;
+		m_switches += switches;
+		if (--m_runningWorkers == 0) m_workersDone.notify_all();
+	}
+public:
+	//[comment]
+	// workers is the number of pool workers Run uses, fibersPerWorker how many jobs each of them
+	// can have started at the same time.
+	//[/comment]
+	FiberScheduler(int workers, int fibersPerWorker, size_t stackSize = FIBER_STACK_SIZE) : m_workers(workers), m_runningWorkers(0), m_jobsRun(0), m_switches(0)
+	{
+		m_fibers.reserve(workers * fibersPerWorker);
+		for (int i = 0; i < workers * fibersPerWorker; ++i) {
+			m_fibers.emplace_back(new Fiber());
+			Fiber* fiber = m_fibers.back().get();
+			fiber->finished = true;
+			fiber->worker = &m_workers[i % workers];
+			fiber->worker->idle.push_back(fiber);
+#if defined _WIN32
+			fiber->context = CreateFiber(stackSize, FiberEntry, fiber);
+#else
+			fiber->stack.resize(stackSize);
+			getcontext(&fiber->context);
+			fiber->context.uc_stack.ss_sp = fiber->stack.data();
+			fiber->context.uc_stack.ss_size = stackSize;
+			fiber->context.uc_link = nullptr;
+			unsigned long long address = (uintptr_t)fiber;
+			makecontext(&fiber->context, (void(*)())FiberEntry, 2, (unsigned int)(address >> 32), (unsigned int)address);
+#endif
+		}
+	}
+	~FiberScheduler()
+	{
+#if defined _WIN32
+		for (std::unique_ptr<Fiber>& fiber : m_fibers) DeleteFiber(fiber->context);
+#endif
+	}
+	FiberScheduler(const FiberScheduler&) = delete;
+	FiberScheduler& operator=(const FiberScheduler&) = delete;
+
+	int WorkerCount() const { return (int)m_workers.size(); }
+	int FiberCount() const { return (int)m_fibers.size(); }
+	//jobs run and switches to a fiber during all the Runs so far
+	unsigned long long JobsRun() const { return m_jobsRun; }
+	unsigned long long Switches() const { return m_switches; }
+
+	//queues a job for the next Run, can also be called by a running job
+	void Add(std::function<void()> job)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(std::move(job));
+	}
+
+	//runs the queued jobs on the first WorkerCount() workers of pool and returns once all have finished
+	void Run(ThreadPool& pool)
+	{
+		m_runningWorkers = WorkerCount();
+		for (int i = 0; i < WorkerCount(); ++i) {
+			Worker* worker = &m_workers[i];
+			pool.SubmitTo(i % pool.Size(), [this, worker]() { WorkerLoop(*worker); });
+		}
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_workersDone.wait(lock, [this] { return m_runningWorkers == 0; });
+	}
+
+	//called by a job: lets the other fibers of this worker run, the job continues after them
+	static void YieldFiber()
+	{
+		Fiber* fiber = CurrentFiber();
+		if (fiber) SwitchToWorker(fiber);
+	}
+};
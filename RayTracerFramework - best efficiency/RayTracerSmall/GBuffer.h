@@ -0,0 +1,22 @@
+#pragma once
+#include "PixelBuffer.h"
+#include "Vec3.h"
+typedef Vec3<float> Vec3f;
+
+//closest hit of a camera ray: BVH slot (-1 if it missed everything), distance and unflipped surface normal
+struct GBufferTexel
+{
+	int slot;
+	float tnear;
+	Vec3f normal;
+};
+
+//[comment]
+// Primary visibility of the last rendered frame. Which sphere a camera ray hits only depends on
+// the geometry, so as long as no sphere moved, was added or was removed (the scene's geometry
+// version is unchanged) a frame can skip the first hit search and start shading from here. This
+// is what a loop that only tweaks materials re-renders the same scene with. The slots are BVH
+// slots, which only change when the geometry does. The version of the PixelBuffer is the scene's
+// geometry version.
+//[/comment]
+typedef PixelBuffer<GBufferTexel> GBuffer;
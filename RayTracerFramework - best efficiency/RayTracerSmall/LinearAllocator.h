@@ -0,0 +1,244 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#if defined _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//[comment]
+// Flags for MapPages and LinearAllocator::Initialize.
+// HUGE_PAGES asks for 2 MiB pages: hugetlbfs pages (MAP_HUGETLB, large pages on Windows) if the system has
+// them reserved, otherwise transparent huge pages (MADV_HUGEPAGE), otherwise the normal pages.
+// LOCKED keeps the pages resident (mlock / VirtualLock) if the process is allowed to, which also
+// makes the first use of every page free.
+//[/comment]
+#define LINEAR_ALLOCATOR_HUGE_PAGES 0x1
+#define LINEAR_ALLOCATOR_LOCKED 0x2
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+//what the pages of a mapping turned out to be
+enum class PageKind
+{
+	Normal,
+	Transparent, //transparent huge pages were asked for, the kernel promotes the pages when it can
+	Huge,        //hugetlbfs / large pages
+};
+
+#if !defined _WIN32
+//maps bytes at a multiple of alignment (a power of two) by mapping alignment more and trimming the ends off
+inline void* MapAlignedPages(size_t bytes, size_t alignment)
+{
+	char* mapping = (char*)mmap(nullptr, bytes + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == (char*)MAP_FAILED) return nullptr;
+	char* aligned = (char*)(((uintptr_t)mapping + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	if (aligned > mapping) munmap(mapping, aligned - mapping);
+	if (aligned < mapping + alignment) munmap(aligned + bytes, mapping + alignment - aligned);
+	return aligned;
+}
+#endif
+
+//[comment]
+// Maps bytes of zeroed memory straight from the OS, bypassing the heap (and the debug heap
+// tracker). bytes is rounded up to whole pages of the kind that was mapped, that size has to be
+// passed to UnmapPages. The pages are only backed by memory once they are first written, so the
+// thread writing them first decides where they are placed. Returns nullptr if nothing could be mapped.
+// The memory starts at a multiple of alignment (a power of two) if that is bigger than a page;
+// on Windows only up to the 64 KiB allocation granularity.
+//[/comment]
+inline void* MapPages(size_t& bytes, int flags, PageKind& kind, bool& locked, size_t alignment = 0)
+{
+	kind = PageKind::Normal;
+	locked = false;
+	void* memory = nullptr;
+#if defined _WIN32
+	if (flags & LINEAR_ALLOCATOR_HUGE_PAGES) {
+		//needs the "lock pages in memory" privilege, large pages are always resident
+		size_t largePage = GetLargePageMinimum();
+		if (largePage > 0) {
+			size_t largeBytes = (bytes + largePage - 1) / largePage * largePage;
+			memory = VirtualAlloc(nullptr, largeBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (memory) {
+				bytes = largeBytes;
+				kind = PageKind::Huge;
+				locked = true;
+				return memory;
+			}
+		}
+	}
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	bytes = (bytes + info.dwPageSize - 1) / info.dwPageSize * info.dwPageSize;
+	memory = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (memory == nullptr) return nullptr;
+	if (flags & LINEAR_ALLOCATOR_LOCKED) locked = VirtualLock(memory, bytes) != 0;
+#else
+	if (flags & LINEAR_ALLOCATOR_HUGE_PAGES) {
+		size_t hugeBytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+#ifdef MAP_HUGETLB
+		//hugetlbfs pages are only aligned to their own size
+		if (alignment <= HUGE_PAGE_SIZE) {
+			memory = mmap(nullptr, hugeBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (memory != MAP_FAILED) {
+				bytes = hugeBytes;
+				kind = PageKind::Huge;
+			}
+			else memory = nullptr;
+		}
+#endif
+		if (memory == nullptr) {
+			//a huge page aligned range, so every 2 MiB of it can be promoted
+			memory = MapAlignedPages(hugeBytes, alignment > HUGE_PAGE_SIZE ? alignment : HUGE_PAGE_SIZE);
+			if (memory == nullptr) return nullptr;
+			bytes = hugeBytes;
+#ifdef MADV_HUGEPAGE
+			if (madvise(memory, bytes, MADV_HUGEPAGE) == 0) kind = PageKind::Transparent;
+#endif
+		}
+	}
+	else {
+		size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+		bytes = (bytes + pageSize - 1) / pageSize * pageSize;
+		if (alignment > pageSize) memory = MapAlignedPages(bytes, alignment);
+		else {
+			memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (memory == MAP_FAILED) memory = nullptr;
+		}
+		if (memory == nullptr) return nullptr;
+	}
+	if (flags & LINEAR_ALLOCATOR_LOCKED) locked = mlock(memory, bytes) == 0;
+#endif
+	return memory;
+}
+
+//false if the OS refused to unmap the pages
+inline bool UnmapPages(void* memory, size_t bytes)
+{
+	if (memory == nullptr) return true;
+#if defined _WIN32
+	return VirtualFree(memory, 0, MEM_RELEASE) != 0;
+#else
+	return munmap(memory, bytes) == 0; //also unlocks
+#endif
+}
+
+//[comment]
+// Page policy of the big buffers, framebuffers and object pools. HugePages maps a buffer of at least
+// LARGE_BUFFER_BYTES with 2 MiB pages (MapPages falls back to transparent huge pages and then normal
+// pages). Smaller buffers, Normal buffers and buffers whose mapping failed come from the heap.
+// A 1080p Vec3f framebuffer spans some 6000 normal pages but only 12 huge ones, so the threads
+// walking it (and the file writer after them) miss the TLB far less.
+//[/comment]
+enum class PagePolicy
+{
+	Normal,
+	HugePages,
+};
+#define LARGE_BUFFER_BYTES (2 * HUGE_PAGE_SIZE)
+
+//in front of every AllocatePages buffer, as big as the alignment it keeps
+struct PagesHeader
+{
+	size_t mappedBytes; //0 if the buffer is on the heap
+	PageKind kind;
+	char padding[64 - sizeof(size_t) - sizeof(PageKind)];
+};
+
+//zeroed buffer of bytes with the given page policy, 64 byte aligned (16 byte if it is on the heap)
+inline void* AllocatePages(size_t bytes, PagePolicy policy)
+{
+	if (policy == PagePolicy::HugePages && bytes >= LARGE_BUFFER_BYTES) {
+		size_t mappedBytes = bytes + sizeof(PagesHeader);
+		PageKind kind;
+		bool locked;
+		PagesHeader* header = (PagesHeader*)MapPages(mappedBytes, LINEAR_ALLOCATOR_HUGE_PAGES, kind, locked);
+		if (header) {
+			header->mappedBytes = mappedBytes;
+			header->kind = kind;
+			return header + 1;
+		}
+	}
+	PagesHeader* header = (PagesHeader*)calloc(1, bytes + sizeof(PagesHeader));
+	if (header == nullptr) return nullptr;
+	header->mappedBytes = 0;
+	header->kind = PageKind::Normal;
+	return header + 1;
+}
+inline void FreePages(void* memory)
+{
+	if (memory == nullptr) return;
+	PagesHeader* header = (PagesHeader*)memory - 1;
+	if (header->mappedBytes > 0) UnmapPages(header, header->mappedBytes);
+	else free(header);
+}
+//what the pages of an AllocatePages buffer turned out to be
+inline PageKind GetPageKind(const void* memory) { return ((const PagesHeader*)memory - 1)->kind; }
+
+//[comment]
+// Bump allocator over one block of pages mapped with MapPages, the desktop version of the
+// PlayStation's direct memory LinearAllocator. Allocating moves an offset forward, nothing is
+// freed on its own: GetMarker remembers the offset and Rewind goes back to it (releasing everything
+// allocated since), Reset goes back to the start. Memory that is rewound over stays mapped and
+// keeps its pages, so a frame that allocates the same buffers again reuses the same physical pages
+// without a call to the OS. Used and peak bytes are kept for the statistics.
+//[/comment]
+class LinearAllocator
+{
+private:
+	char* m_base;
+	size_t m_capacity, m_used, m_peak;
+	PageKind m_pageKind;
+	bool m_locked;
+public:
+	typedef size_t Marker;
+
+	LinearAllocator() : m_base(nullptr), m_capacity(0), m_used(0), m_peak(0), m_pageKind(PageKind::Normal), m_locked(false) {}
+	~LinearAllocator() { Terminate(); }
+	LinearAllocator(const LinearAllocator&) = delete;
+	LinearAllocator& operator=(const LinearAllocator&) = delete;
+
+	//maps at least bytes of memory, see MapPages for the flags. False if nothing could be mapped
+	bool Initialize(size_t bytes, int flags = 0)
+	{
+		Terminate();
+		m_base = (char*)MapPages(bytes, flags, m_pageKind, m_locked);
+		m_capacity = m_base ? bytes : 0;
+		return m_base != nullptr;
+	}
+	void Terminate()
+	{
+		UnmapPages(m_base, m_capacity);
+		m_base = nullptr;
+		m_capacity = m_used = m_peak = 0;
+	}
+
+	//nullptr if the block is full; alignment has to be a power of two
+	void* Allocate(size_t bytes, size_t alignment = 64)
+	{
+		size_t offset = (m_used + alignment - 1) & ~(alignment - 1);
+		if (m_base == nullptr || offset + bytes > m_capacity) return nullptr;
+		m_used = offset + bytes;
+		if (m_used > m_peak) m_peak = m_used;
+		return m_base + offset;
+	}
+	//uninitialised storage for count objects of T
+	template <class T>
+	T* AllocateArray(size_t count) { return (T*)Allocate(count * sizeof(T), alignof(T) > 64 ? alignof(T) : 64); }
+
+	Marker GetMarker() const { return m_used; }
+	void Rewind(Marker marker) { m_used = marker; }
+	void Reset() { m_used = 0; }
+
+	size_t Capacity() const { return m_capacity; }
+	size_t Used() const { return m_used; }
+	size_t Peak() const { return m_peak; }
+	PageKind GetPageKind() const { return m_pageKind; }
+	bool IsLocked() const { return m_locked; }
+};
@@ -1,6 +1,10 @@
 #ifdef _DEBUG
 
 #include "MemoryDebugger.h"
+#include <mutex>
+
+//the tracked heaps are linked lists shared by every thread, so the render threads take turns changing them
+static std::mutex heapMutex;
 
 //initialization of a static variables
 MemoryHeap* HeapManager::heaps[2];
@@ -95,7 +99,7 @@ bool MemoryHeap::WalkTheHeap()
 //definitions for new and delete overrides
 void* operator new(size_t size)
 {
-
+    std::lock_guard<std::mutex> lock(heapMutex);
 
     if (!HeapManager::initialized) HeapManager::InitializeHeaps();
 
@@ -131,6 +135,7 @@ void* operator new(size_t size)
 
 void operator delete(void* pMem)
 {
+    std::lock_guard<std::mutex> lock(heapMutex);
     Header* pHeader = GetHeaderPntr(pMem);
     Footer* pFooter = GetFooterPntr(pMem);
 
@@ -162,6 +167,7 @@ void* operator new(size_t size, HeapID heapType)
     else if (heapType == HeapID::Heap)
         return ::operator new(size, true);
     else {
+        std::lock_guard<std::mutex> lock(heapMutex);
         if (!HeapManager::initialized) HeapManager::InitializeHeaps();
        
         size_t nRequestedBytes = size + sizeof(Header) + sizeof(Footer); //requested size plus the size of header and footer
@@ -1,8 +1,36 @@
 #pragma once
 #include "MemoryDebugger.h"
+#include "LinearAllocator.h"
 #include <vector>
-#include <algorithm>
+#include <stdint.h>
+#include <cassert>
+
+//[comment]
+// Names an object of a MemoryPool: its slot and the generation the slot was in when the object
+// was constructed. Releasing an object moves its slot to the next generation, so a handle that
+// outlived its object is stale and MemoryPool::Get returns nullptr for it, even if the slot holds
+// a new object by then.
+//[/comment]
+struct PoolHandle
+{
+	int index;
+	uint32_t generation;
+	PoolHandle() : index(-1), generation(0) {}
+	PoolHandle(int index, uint32_t generation) : index(index), generation(generation) {}
+};
 
+//[comment]
+// Fixed size pool of T in one block. Free slots are kept in an intrusive free list, the index of
+// the next free slot is stored in the free slot itself, so constructing an object in the pool and
+// releasing any object are O(1) whatever the slot. The list is last in first out, an object
+// constructed after a release takes the slot that was just freed.
+// objects has one entry per slot, nullptr for a free slot, and stays indexed by slot so the renderer
+// can keep per object state by slot. GetLiveSlots lists the slots of the live objects without gaps
+// (in no particular order after a release), for code that should only visit those. The live
+// objects are also linked in the order they were constructed, so ReleaseLast still releases the
+// newest one and ReleaseObjects releases them newest first.
+// Releasing an object doesn't call its destructor, the slot is just given back.
+//[/comment]
 template<class T>
 class MemoryPool
 {
@@ -10,21 +38,45 @@ private:
 	int m_poolMaxObjCount;
 	size_t m_poolMaxByteSize;
 	size_t m_objectSize;
-	int m_objectCount;
 	void* memoryPoolBlockStart;
+	int m_freeHead; //first free slot, -1 if the pool is full
+	std::vector<uint32_t> m_generation; //one per slot, goes up when its object is released
+	std::vector<int> m_live; //slots of the live objects
+	std::vector<int> m_livePosition; //slot -> index in m_live, -1 for a free slot
+	std::vector<int> m_older, m_newer; //slot -> live slot constructed just before/after it, -1 if there is none
+	int m_newest; //slot of the newest live object, -1 if the pool is empty
+	std::vector<char> m_static; //one flag per slot, see SetStatic
+
+	static_assert(sizeof(T) >= sizeof(int), "a free slot has to hold the index of the next one");
+
+	//start of the object in a slot, past the header in debug mode
+	void* SlotMemory(int pos) const
+	{
+		char* pMem = (char*)memoryPoolBlockStart + m_objectSize * pos;
+		#ifdef _DEBUG
+		pMem += sizeof(Header);
+		#endif // _DEBUG
+		return pMem;
+	}
+	//next free slot, kept in the free slot
+	int& NextFree(int pos) const { return *(int*)SlotMemory(pos); }
 public:
 	std::vector<T*> objects;
-	MemoryPool(int poolMaxObjCount)
+	//pagePolicy decides the pages of the pool's block, a pool of many objects can ask for huge pages (see AllocatePages)
+	MemoryPool(int poolMaxObjCount, PagePolicy pagePolicy = PagePolicy::Normal)
 	{
-		m_objectCount = 0;
 		m_poolMaxObjCount = poolMaxObjCount;
 		m_objectSize = sizeof(T);
 
 		//initialize the vector with nullptrs
-		for (int i = 0; i < poolMaxObjCount; i++)
-		{
-			objects.push_back(nullptr);
-		}
+		objects.assign(poolMaxObjCount, nullptr);
+		m_generation.assign(poolMaxObjCount, 0);
+		m_live.reserve(poolMaxObjCount);
+		m_livePosition.assign(poolMaxObjCount, -1);
+		m_older.assign(poolMaxObjCount, -1);
+		m_newer.assign(poolMaxObjCount, -1);
+		m_newest = -1;
+		m_static.assign(poolMaxObjCount, 0);
 
 		#ifdef _DEBUG
 		m_objectSize += sizeof(Header) + sizeof(Footer);
@@ -32,8 +84,8 @@ public:
 
 		m_poolMaxByteSize = m_objectSize * m_poolMaxObjCount;
 
-		//allocate x times of object size amount of memory. Calloc takes longer than malloc but is ensures that the memory is always one single block.
-		memoryPoolBlockStart = calloc(m_poolMaxObjCount, m_objectSize);
+		//allocate x times of object size amount of memory, zeroed and in one single block.
+		memoryPoolBlockStart = AllocatePages(m_poolMaxByteSize, pagePolicy);
 
 		//setup headers and footers in debug mode
 		#ifdef _DEBUG
@@ -63,6 +115,12 @@ public:
 		}
 		HeapManager::GetHeapByIndex((int)HeapID::Graphics)->AddBytes(m_poolMaxByteSize);
 		#endif // _DEBUG
+
+		//chain all slots in order, so the first objects fill the pool from the front
+		for (int i = 0; i < poolMaxObjCount; i++) {
+			NextFree(i) = i + 1 < poolMaxObjCount ? i + 1 : -1;
+		}
+		m_freeHead = poolMaxObjCount > 0 ? 0 : -1;
 	}
 	~MemoryPool()
 	{
@@ -89,34 +147,113 @@ public:
 		}
 		#endif // _DEBUG
 		objects.clear();
-		free(memoryPoolBlockStart);
+		FreePages(memoryPoolBlockStart);
 		#ifdef _DEBUG
 		HeapManager::GetHeapByIndex((int)HeapID::Graphics)->SubtractBytes(m_poolMaxByteSize);
 		#endif // _DEBUG
 	}
+	MemoryPool(const MemoryPool&) = delete;
+	MemoryPool& operator=(const MemoryPool&) = delete;
+
+	//[comment]
+	// Takes the slot at the head of the free list and returns the memory to construct the object in,
+	// nullptr if the pool is full. Used by the placement new below.
+	//[/comment]
+	void* Allocate()
+	{
+		if (m_freeHead < 0) return nullptr;
+		int pos = m_freeHead;
+		void* pMem = SlotMemory(pos);
+		m_freeHead = NextFree(pos);
+		objects[pos] = (T*)pMem;
+		m_livePosition[pos] = (int)m_live.size();
+		m_live.push_back(pos);
+		m_older[pos] = m_newest;
+		m_newer[pos] = -1;
+		if (m_newest >= 0) m_newer[m_newest] = pos;
+		m_newest = pos;
+		return pMem;
+	}
 	void ReleaseObjects()
 	{
-		int originalCount = count();
 		//release all objects
-		for (int i = 0; i < originalCount; i++) {
+		while (count() > 0) {
 			ReleaseLast();
 		}
 	}
+	//releases the newest live object
 	void ReleaseLast()
 	{
-		//get the last object and call its destructor
-		ReleaseAt(m_objectCount - 1);
-		
+		if (m_newest >= 0) ReleaseAt(m_newest);
 	}
-	void ReleaseAt(int pos) 
+	//releases the object in slot pos, nothing happens if the slot is free. pos has to be a slot of
+	//the pool (asserted in debug), release builds ignore anything else.
+	void ReleaseAt(int pos)
 	{
+		assert(pos >= 0 && pos < m_poolMaxObjCount);
+		if (pos < 0 || pos >= m_poolMaxObjCount) return;
+		int livePos = m_livePosition[pos];
+		if (livePos < 0) return;
+		//optimization: the last live slot takes the released one's place in m_live, no shifting
+		m_live[livePos] = m_live.back();
+		m_livePosition[m_live[livePos]] = livePos;
+		m_live.pop_back();
+		m_livePosition[pos] = -1;
+		if (m_older[pos] >= 0) m_newer[m_older[pos]] = m_newer[pos];
+		if (m_newer[pos] >= 0) m_older[m_newer[pos]] = m_older[pos];
+		else m_newest = m_older[pos];
+
 		objects[pos] = nullptr;
-		Decrement();
+		m_static[pos] = 0;
+		m_generation[pos]++;
+		NextFree(pos) = m_freeHead;
+		m_freeHead = pos;
+	}
+	//releases the object of a handle, false if the handle is stale
+	bool Release(PoolHandle handle)
+	{
+		if (!IsValid(handle)) return false;
+		ReleaseAt(handle.index);
+		return true;
 	}
 	T* GetAt(int pos) const {
 		return objects[pos];
 	}
-	int count() const { return m_objectCount; }
+	//the object of a handle, nullptr if it has been released since the handle was made
+	T* Get(PoolHandle handle) const { return IsValid(handle) ? objects[handle.index] : nullptr; }
+	bool IsValid(PoolHandle handle) const
+	{
+		return handle.index >= 0 && handle.index < m_poolMaxObjCount && objects[handle.index] != nullptr &&
+			m_generation[handle.index] == handle.generation;
+	}
+	//handle of the object in slot pos (which has to be live)
+	PoolHandle GetHandle(int pos) const { return PoolHandle(pos, m_generation[pos]); }
+	//handle of an object of this pool, an invalid handle for any other address
+	PoolHandle GetHandle(const T* object) const
+	{
+		int pos = IndexOf(object);
+		return pos >= 0 ? GetHandle(pos) : PoolHandle();
+	}
+	//slot of an object of this pool from its address, -1 if the address is not the start of a slot
+	int IndexOf(const T* object) const
+	{
+		uintptr_t first = (uintptr_t)SlotMemory(0), address = (uintptr_t)object;
+		if (address < first || (address - first) % m_objectSize != 0) return -1;
+		uintptr_t pos = (address - first) / m_objectSize;
+		return pos < (uintptr_t)m_poolMaxObjCount ? (int)pos : -1;
+	}
+
+	int count() const { return (int)m_live.size(); }
+	const std::vector<int>& GetLiveSlots() const { return m_live; }
+
+	//[comment]
+	// A static object promises not to move or change until it is released, so the renderer may
+	// cache what rays hit of it across frames. Objects are dynamic by default and a slot becomes
+	// dynamic again when its object is released.
+	//[/comment]
+	void SetStatic(int pos, bool isStatic) { m_static[pos] = isStatic; }
+	bool IsStatic(int pos) const { return m_static[pos] != 0; }
+	const std::vector<char>& GetStaticFlags() const { return m_static; }
 
 	size_t GetObjectSize() const { return m_objectSize; }
 
@@ -126,9 +263,6 @@ public:
 
 	void* GetPoolMemBlock() const { return memoryPoolBlockStart; }
 
-	void Increment() { m_objectCount++; }
-	void Decrement() { m_objectCount--; }
-
 	
 
 //new and delete overrides
@@ -151,78 +285,17 @@ void* operator new (size_t size, MemoryPool<T>* pool)
 	requestedBytes += sizeof(Header) + sizeof(Footer);
 	#endif // DEBUG
 
-
-	if (pool->count() == pool->GetMaxCount()) {
-		//error: pool is full
-		return nullptr;
-	}
-	else if (requestedBytes != pool->GetObjectSize()) {
-		//error: wrong object type
-		return nullptr;
-	}
-	
-	void* thisMemBlock = pool->GetPoolMemBlock();
-	thisMemBlock = (void*)((char*)thisMemBlock + (pool->GetObjectSize() * pool->count()));
-
-	#ifdef _DEBUG
-	thisMemBlock = (void*)((char*)thisMemBlock + sizeof(Header));
-	#endif // _DEBUG
-
-	pool->objects.at(pool->count()) = (T*)thisMemBlock;
-	pool->Increment();
-
-	return thisMemBlock;
-}
-template<typename T>
-void* operator new (size_t size, MemoryPool<T> pool)
-{
-	size_t requestedBytes = size;
-#ifdef _DEBUG
-	requestedBytes += sizeof(Header) + sizeof(Footer);
-#endif // DEBUG
-
-
-	if (pool.count() == pool.GetMaxCount()) {
-		//error: pool is full
-		return nullptr;
-	}
-	else if (requestedBytes != pool.GetObjectSize()) {
+	if (requestedBytes != pool->GetObjectSize()) {
 		//error: wrong object type
 		return nullptr;
 	}
-
-	void* thisMemBlock = pool.GetPoolMemBlock();
-	thisMemBlock = (void*)((char*)thisMemBlock + (pool->GetObjectSize() * pool.count()));
-
-#ifdef _DEBUG
-	thisMemBlock = (void*)((char*)thisMemBlock + sizeof(Header));
-#endif // _DEBUG
-
-	pool.objects.at(pool.count()) = (T*)thisMemBlock;
-	pool.Increment();
-
-	return thisMemBlock;
+	//nullptr if the pool is full
+	return pool->Allocate();
 }
 
 template<typename T>
 void operator delete (void* pMem, MemoryPool<T>* pool)
 {
-	//release the object rather than deleting it
-	T* obj = (T*)pMem;
-	auto it = find(pool->objects.begin(), pool->objects.end(), obj);
-	if (it != pool->objects.end()) {
-		int index = it - pool->objects.begin();
-		pool->ReleaseAt(index);
-	}
-}
-template<typename T>
-void operator delete (void* pMem, MemoryPool<T> pool)
-{
-	//release the object rather than deleting it
-	T* obj = (T*)pMem;
-	auto it = find(pool.objects.begin(), pool.objects.end(), obj);
-	if (it != pool.objects.end()) {
-		int index = it - pool.objects.begin();
-		pool.ReleaseAt(index);
-	}
+	//release the object rather than deleting it, its slot follows from the address
+	pool->ReleaseAt(pool->IndexOf((T*)pMem));
 }
\ No newline at end of file
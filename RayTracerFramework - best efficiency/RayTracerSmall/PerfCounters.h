@@ -0,0 +1,52 @@
+#pragma once
+#if defined __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+//[comment]
+// Data TLB misses (user mode loads) of the thread that created the counter, counted by the CPU's
+// performance monitoring unit through perf_event_open. The counter can be read from any thread.
+// Where the counter can't be opened (other platforms, perf_event_paranoid > 2, virtual machines
+// without a virtual PMU) IsAvailable is false and Read returns 0.
+//[/comment]
+class TlbMissCounter
+{
+private:
+	int m_fd;
+public:
+	TlbMissCounter() : m_fd(-1)
+	{
+#if defined __linux__
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		m_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0); //this thread, any cpu
+#endif
+	}
+	~TlbMissCounter()
+	{
+#if defined __linux__
+		if (m_fd >= 0) close(m_fd);
+#endif
+	}
+	TlbMissCounter(const TlbMissCounter&) = delete;
+	TlbMissCounter& operator=(const TlbMissCounter&) = delete;
+
+	bool IsAvailable() const { return m_fd >= 0; }
+	unsigned long long Read() const
+	{
+		unsigned long long count = 0;
+#if defined __linux__
+		if (m_fd >= 0 && read(m_fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+#endif
+		return count;
+	}
+};
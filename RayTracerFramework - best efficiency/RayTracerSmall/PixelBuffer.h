@@ -0,0 +1,38 @@
+#pragma once
+#include <vector>
+
+//[comment]
+// One Texel per pixel of the last rendered frame, kept across frames. The data is only good for
+// the scene version it was recorded at (a BVH build count, a geometry version, whatever the texels
+// depend on): a frame that rendered completely calls Validate with its version, and the next frame
+// asks IsValid with its own to know whether it can reuse the texels or has to record them again.
+// Buffers with more than one record per pixel derive from it and size their row data in Resize.
+//[/comment]
+template <typename Texel>
+class PixelBuffer
+{
+private:
+	unsigned m_width, m_height;
+	int m_version; //scene version the pixels were recorded at, -1 if there are none
+public:
+	std::vector<Texel> pixels;
+
+	PixelBuffer() : m_width(0), m_height(0), m_version(-1) {}
+	PixelBuffer(const PixelBuffer&) = delete;
+	PixelBuffer& operator=(const PixelBuffer&) = delete;
+
+	//returns false if the buffer already had this size, its pixels are kept then
+	bool Resize(unsigned width, unsigned height)
+	{
+		if (width == m_width && height == m_height) return false;
+		m_width = width;
+		m_height = height;
+		pixels.assign(width * height, Texel());
+		Invalidate();
+		return true;
+	}
+	void Invalidate() { m_version = -1; }
+	//called once a frame has been rendered completely, with the version it used
+	void Validate(int version) { m_version = version; }
+	bool IsValid(int version) const { return m_version >= 0 && m_version == version; }
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include "Vec3.h"
+#include "Simd.h"
+typedef Vec3<float> Vec3f;
+
+//[comment]
+// Primary rays are traced in square blocks of PACKET_DIM x PACKET_DIM pixels (4 or 8).
+// PACKET_SIZE has to stay a multiple of SIMD_WIDTH, which holds for both block sizes.
+//[/comment]
+#define PACKET_DIM 4
+#define PACKET_SIZE (PACKET_DIM * PACKET_DIM)
+
+//[comment]
+// A bundle of coherent rays sharing one origin (the camera), with the directions stored as
+// structure-of-arrays so SIMD_WIDTH rays can be tested against a sphere per instruction.
+// Blocks cut off by the image or band edge only fill the first count rays, the rest of the
+// lanes repeat the last ray so they never produce extra work.
+//[/comment]
+struct RayPacket
+{
+	Vec3f origin;
+	alignas(32) float dirX[PACKET_SIZE];
+	alignas(32) float dirY[PACKET_SIZE];
+	alignas(32) float dirZ[PACKET_SIZE];
+	int count;
+
+	RayPacket(const Vec3f& o) : origin(o), count(0) {}
+
+	void Add(const Vec3f& dir)
+	{
+		dirX[count] = dir.x;
+		dirY[count] = dir.y;
+		dirZ[count] = dir.z;
+		count++;
+	}
+	void Pad()
+	{
+		for (int i = count; i < PACKET_SIZE; ++i) {
+			dirX[i] = dirX[count - 1];
+			dirY[i] = dirY[count - 1];
+			dirZ[i] = dirZ[count - 1];
+		}
+	}
+	Vec3f GetDirection(int i) const { return Vec3f(dirX[i], dirY[i], dirZ[i]); }
+};
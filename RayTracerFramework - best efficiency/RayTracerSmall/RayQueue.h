@@ -0,0 +1,141 @@
+#pragma once
+#include "Vec3.h"
+#include "Simd.h"
+typedef Vec3<float> Vec3f;
+
+//[comment]
+// Ray buffers of the wavefront renderer. Every field lives in its own aligned array so each
+// stage streams through exactly the data it needs, one ray after the other, instead of chasing
+// the state of a single ray through a chain of calls.
+// Reserve only keeps the contents when the buffer is big enough already, so it is called on an
+// empty queue before a stage fills it.
+//[/comment]
+class RayQueue
+{
+private:
+	int m_capacity;
+
+	void Free()
+	{
+		if (m_capacity == 0) return;
+		float* floats[] = { originX, originY, originZ, dirX, dirY, dirZ, weightX, weightY, weightZ, tnear,
+			pointX, pointY, pointZ, normalX, normalY, normalZ };
+		for (float* f : floats) SimdFree(f);
+		SimdFree(hitIndex);
+		SimdFree(inside);
+		SimdFree(pixel);
+		SimdFree(depth);
+		m_capacity = 0;
+	}
+public:
+	//filled by the generate and spawn stages
+	float* originX, * originY, * originZ;
+	float* dirX, * dirY, * dirZ;
+	float* weightX, * weightY, * weightZ; //product of the fresnel/transparency factors and surface colours above the ray
+	int* pixel; //index of the pixel the ray contributes to
+	int* depth;
+	//filled by the closest hit stage, hitIndex is -1 for a miss
+	float* tnear;
+	int* hitIndex;
+	//filled by the shade stage for the spawn stage, the normal already faces the ray
+	float* pointX, * pointY, * pointZ;
+	float* normalX, * normalY, * normalZ;
+	int* inside; //1 if the ray hit the sphere from the inside
+	int count;
+
+	RayQueue() : m_capacity(0), count(0) {}
+	~RayQueue() { Free(); }
+	RayQueue(const RayQueue&) = delete;
+	RayQueue& operator=(const RayQueue&) = delete;
+
+	void Reserve(int capacity)
+	{
+		if (capacity <= m_capacity) return;
+		Free();
+		m_capacity = (capacity + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+		float** floats[] = { &originX, &originY, &originZ, &dirX, &dirY, &dirZ, &weightX, &weightY, &weightZ, &tnear,
+			&pointX, &pointY, &pointZ, &normalX, &normalY, &normalZ };
+		for (float** f : floats) *f = (float*)SimdAlloc(sizeof(float) * m_capacity);
+		hitIndex = (int*)SimdAlloc(sizeof(int) * m_capacity);
+		inside = (int*)SimdAlloc(sizeof(int) * m_capacity);
+		pixel = (int*)SimdAlloc(sizeof(int) * m_capacity);
+		depth = (int*)SimdAlloc(sizeof(int) * m_capacity);
+	}
+	void Clear() { count = 0; }
+
+	void Push(const Vec3f& origin, const Vec3f& dir, const Vec3f& weight, int rayPixel, int rayDepth)
+	{
+		originX[count] = origin.x, originY[count] = origin.y, originZ[count] = origin.z;
+		dirX[count] = dir.x, dirY[count] = dir.y, dirZ[count] = dir.z;
+		weightX[count] = weight.x, weightY[count] = weight.y, weightZ[count] = weight.z;
+		pixel[count] = rayPixel;
+		depth[count] = rayDepth;
+		count++;
+	}
+
+	Vec3f GetOrigin(int i) const { return Vec3f(originX[i], originY[i], originZ[i]); }
+	Vec3f GetDirection(int i) const { return Vec3f(dirX[i], dirY[i], dirZ[i]); }
+	Vec3f GetWeight(int i) const { return Vec3f(weightX[i], weightY[i], weightZ[i]); }
+	Vec3f GetPoint(int i) const { return Vec3f(pointX[i], pointY[i], pointZ[i]); }
+	Vec3f GetNormal(int i) const { return Vec3f(normalX[i], normalY[i], normalZ[i]); }
+};
+
+//[comment]
+// Shadow rays waiting for the shadow stage. contribution is what reaches the pixel if the light
+// is not blocked, so the stage only has to run the any-hit query and add it.
+//[/comment]
+class ShadowQueue
+{
+private:
+	int m_capacity;
+
+	void Free()
+	{
+		if (m_capacity == 0) return;
+		float* floats[] = { originX, originY, originZ, dirX, dirY, dirZ, tmax, contributionX, contributionY, contributionZ };
+		for (float* f : floats) SimdFree(f);
+		SimdFree(light);
+		SimdFree(pixel);
+		m_capacity = 0;
+	}
+public:
+	float* originX, * originY, * originZ;
+	float* dirX, * dirY, * dirZ;
+	float* tmax; //distance to the light, blockers behind it don't count
+	float* contributionX, * contributionY, * contributionZ;
+	int* light; //BVH slot of the light, the shadow ray never counts it as a blocker
+	int* pixel;
+	int count;
+
+	ShadowQueue() : m_capacity(0), count(0) {}
+	~ShadowQueue() { Free(); }
+	ShadowQueue(const ShadowQueue&) = delete;
+	ShadowQueue& operator=(const ShadowQueue&) = delete;
+
+	void Reserve(int capacity)
+	{
+		if (capacity <= m_capacity) return;
+		Free();
+		m_capacity = (capacity + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+		float** floats[] = { &originX, &originY, &originZ, &dirX, &dirY, &dirZ, &tmax, &contributionX, &contributionY, &contributionZ };
+		for (float** f : floats) *f = (float*)SimdAlloc(sizeof(float) * m_capacity);
+		light = (int*)SimdAlloc(sizeof(int) * m_capacity);
+		pixel = (int*)SimdAlloc(sizeof(int) * m_capacity);
+	}
+	void Clear() { count = 0; }
+
+	void Push(const Vec3f& origin, const Vec3f& dir, float distance, const Vec3f& contribution, int lightSlot, int rayPixel)
+	{
+		originX[count] = origin.x, originY[count] = origin.y, originZ[count] = origin.z;
+		dirX[count] = dir.x, dirY[count] = dir.y, dirZ[count] = dir.z;
+		tmax[count] = distance;
+		contributionX[count] = contribution.x, contributionY[count] = contribution.y, contributionZ[count] = contribution.z;
+		light[count] = lightSlot;
+		pixel[count] = rayPixel;
+		count++;
+	}
+
+	Vec3f GetOrigin(int i) const { return Vec3f(originX[i], originY[i], originZ[i]); }
+	Vec3f GetDirection(int i) const { return Vec3f(dirX[i], dirY[i], dirZ[i]); }
+	Vec3f GetContribution(int i) const { return Vec3f(contributionX[i], contributionY[i], contributionZ[i]); }
+};
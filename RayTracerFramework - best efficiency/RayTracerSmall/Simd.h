@@ -0,0 +1,82 @@
+#pragma once
+#include <immintrin.h>
+//[comment]
+// Thin wrappers over the SSE/AVX2 intrinsics so the intersection kernels can be written once.
+// Builds with AVX2 enabled (/arch:AVX2 or -mavx2) process 8 lanes per instruction, every other
+// x64 build falls back to SSE with 4 lanes.
+//[/comment]
+
+#if defined(__AVX2__)
+
+#define SIMD_WIDTH 8
+typedef __m256 SimdFloat;
+typedef __m256i SimdInt;
+
+inline SimdFloat SimdSet(float f) { return _mm256_set1_ps(f); }
+inline SimdFloat SimdLoad(const float* p) { return _mm256_load_ps(p); }
+inline void SimdStore(float* p, SimdFloat v) { _mm256_store_ps(p, v); }
+inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a, b); }
+inline SimdFloat SimdSub(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a, b); }
+inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a, b); }
+inline SimdFloat SimdSqrt(SimdFloat a) { return _mm256_sqrt_ps(a); }
+inline SimdFloat SimdMin(SimdFloat a, SimdFloat b) { return _mm256_min_ps(a, b); }
+inline SimdFloat SimdMax(SimdFloat a, SimdFloat b) { return _mm256_max_ps(a, b); }
+inline SimdFloat SimdAnd(SimdFloat a, SimdFloat b) { return _mm256_and_ps(a, b); }
+inline SimdFloat SimdOr(SimdFloat a, SimdFloat b) { return _mm256_or_ps(a, b); }
+inline SimdFloat SimdLess(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline SimdFloat SimdLessEqual(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline SimdFloat SimdGreaterEqual(SimdFloat a, SimdFloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+//picks b where the mask is set, a everywhere else
+inline SimdFloat SimdSelect(SimdFloat mask, SimdFloat a, SimdFloat b) { return _mm256_blendv_ps(a, b, mask); }
+inline int SimdMoveMask(SimdFloat mask) { return _mm256_movemask_ps(mask); }
+
+inline SimdInt SimdSetInt(int i) { return _mm256_set1_epi32(i); }
+inline SimdInt SimdLaneIndices() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+inline SimdInt SimdAddInt(SimdInt a, SimdInt b) { return _mm256_add_epi32(a, b); }
+inline SimdInt SimdSelectInt(SimdFloat mask, SimdInt a, SimdInt b)
+{
+	return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), mask));
+}
+inline SimdInt SimdLoadInt(const int* p) { return _mm256_load_si256((const __m256i*)p); }
+inline void SimdStoreInt(int* p, SimdInt v) { _mm256_store_si256((__m256i*)p, v); }
+
+#else
+
+#define SIMD_WIDTH 4
+typedef __m128 SimdFloat;
+typedef __m128i SimdInt;
+
+inline SimdFloat SimdSet(float f) { return _mm_set1_ps(f); }
+inline SimdFloat SimdLoad(const float* p) { return _mm_load_ps(p); }
+inline void SimdStore(float* p, SimdFloat v) { _mm_store_ps(p, v); }
+inline SimdFloat SimdAdd(SimdFloat a, SimdFloat b) { return _mm_add_ps(a, b); }
+inline SimdFloat SimdSub(SimdFloat a, SimdFloat b) { return _mm_sub_ps(a, b); }
+inline SimdFloat SimdMul(SimdFloat a, SimdFloat b) { return _mm_mul_ps(a, b); }
+inline SimdFloat SimdSqrt(SimdFloat a) { return _mm_sqrt_ps(a); }
+inline SimdFloat SimdMin(SimdFloat a, SimdFloat b) { return _mm_min_ps(a, b); }
+inline SimdFloat SimdMax(SimdFloat a, SimdFloat b) { return _mm_max_ps(a, b); }
+inline SimdFloat SimdAnd(SimdFloat a, SimdFloat b) { return _mm_and_ps(a, b); }
+inline SimdFloat SimdOr(SimdFloat a, SimdFloat b) { return _mm_or_ps(a, b); }
+inline SimdFloat SimdLess(SimdFloat a, SimdFloat b) { return _mm_cmplt_ps(a, b); }
+inline SimdFloat SimdLessEqual(SimdFloat a, SimdFloat b) { return _mm_cmple_ps(a, b); }
+inline SimdFloat SimdGreaterEqual(SimdFloat a, SimdFloat b) { return _mm_cmpge_ps(a, b); }
+//picks b where the mask is set, a everywhere else (SSE2 has no blend instruction)
+inline SimdFloat SimdSelect(SimdFloat mask, SimdFloat a, SimdFloat b) { return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a)); }
+inline int SimdMoveMask(SimdFloat mask) { return _mm_movemask_ps(mask); }
+
+inline SimdInt SimdSetInt(int i) { return _mm_set1_epi32(i); }
+inline SimdInt SimdLaneIndices() { return _mm_setr_epi32(0, 1, 2, 3); }
+inline SimdInt SimdAddInt(SimdInt a, SimdInt b) { return _mm_add_epi32(a, b); }
+inline SimdInt SimdSelectInt(SimdFloat mask, SimdInt a, SimdInt b)
+{
+	SimdInt m = _mm_castps_si128(mask);
+	return _mm_or_si128(_mm_and_si128(m, b), _mm_andnot_si128(m, a));
+}
+inline SimdInt SimdLoadInt(const int* p) { return _mm_load_si128((const __m128i*)p); }
+inline void SimdStoreInt(int* p, SimdInt v) { _mm_store_si128((__m128i*)p, v); }
+
+#endif // __AVX2__
+
+//aligned allocation that bypasses the debug heap tracker (its headers break 16/32 byte alignment)
+inline void* SimdAlloc(size_t bytes) { return _mm_malloc(bytes, 32); }
+inline void SimdFree(void* p) { _mm_free(p); }
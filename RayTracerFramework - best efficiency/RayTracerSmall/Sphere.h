@@ -35,4 +35,19 @@ public:
 
 		return true;
 	}
+	//[comment]
+	// Any-hit version of intersect for shadow rays. True if the ray enters the sphere before tmax,
+	// found without the square root and without computing the hit distances.
+	//[/comment]
+	bool occluded(const Vec3f& rayorig, const Vec3f& raydir, const float& tmax) const
+	{
+		Vec3f l = center - rayorig; //line from ray origin to sphere centre
+		float tca = l.dot(raydir); //dot product the line with ray direction
+		if (tca < 0) return false; //facing away, same as intersect
+		float d2 = l.dot(l) - tca * tca; //how far the direction vector is from the centre (squared)
+		if (d2 > radius2) return false; //the ray misses the sphere
+		//the entry point tca - sqrt(radius2 - d2) is closer than tmax if tca - tmax < sqrt(radius2 - d2)
+		float beyond = tca - tmax;
+		return beyond < 0 || beyond * beyond < radius2 - d2;
+	}
 };
\ No newline at end of file
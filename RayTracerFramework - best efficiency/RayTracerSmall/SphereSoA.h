@@ -0,0 +1,248 @@
+#pragma once
+#include <vector>
+#include "Sphere.h"
+#include "Simd.h"
+#include "RayPacket.h"
+
+//[comment]
+// Structure-of-arrays copy of the sphere geometry. The centres and radius^2 of every sphere
+// live in separate aligned arrays so the intersection kernels can test SIMD_WIDTH spheres
+// per instruction instead of chasing one Sphere* at a time. The material data stays in the
+// Sphere objects, which are looked up through the spheres vector with the same index.
+//[/comment]
+class SphereSoA
+{
+private:
+	int m_count;
+	int m_capacity; //always a multiple of SIMD_WIDTH, the padding lanes can never be hit
+	float* m_centerX;
+	float* m_centerY;
+	float* m_centerZ;
+	float* m_radius2;
+
+	void Reserve(int capacity)
+	{
+		if (capacity <= m_capacity) return;
+		Free();
+		m_capacity = capacity;
+		m_centerX = (float*)SimdAlloc(sizeof(float) * capacity);
+		m_centerY = (float*)SimdAlloc(sizeof(float) * capacity);
+		m_centerZ = (float*)SimdAlloc(sizeof(float) * capacity);
+		m_radius2 = (float*)SimdAlloc(sizeof(float) * capacity);
+	}
+	void Free()
+	{
+		if (m_centerX) {
+			SimdFree(m_centerX);
+			SimdFree(m_centerY);
+			SimdFree(m_centerZ);
+			SimdFree(m_radius2);
+		}
+		m_centerX = m_centerY = m_centerZ = m_radius2 = nullptr;
+		m_capacity = 0;
+	}
+public:
+	std::vector<const Sphere*> spheres; //material lookup, same order as the arrays (nullptr for empty slots)
+
+	SphereSoA() : m_count(0), m_capacity(0), m_centerX(nullptr), m_centerY(nullptr), m_centerZ(nullptr), m_radius2(nullptr) {}
+	~SphereSoA() { Free(); }
+	SphereSoA(const SphereSoA&) = delete;
+	SphereSoA& operator=(const SphereSoA&) = delete;
+
+	//copies the geometry out of the sphere pointers, empty pool slots are skipped.
+	//the arrays are only reallocated when the scene grows, so this is cheap to call every frame.
+	void Build(const std::vector<Sphere*>& objects)
+	{
+		int live = 0;
+		for (unsigned i = 0; i < objects.size(); ++i) {
+			if (objects[i] != nullptr) live++;
+		}
+		Resize(live);
+		int slot = 0;
+		for (unsigned i = 0; i < objects.size(); ++i) {
+			if (objects[i] != nullptr) Set(slot++, objects[i]);
+		}
+	}
+
+	//[comment]
+	// Slot level access, used when the spheres have to be laid out in a specific order (the BVH
+	// leaves). Resize rounds the slot count up to SIMD_WIDTH and clears every slot.
+	//[/comment]
+	void Resize(int slots)
+	{
+		m_count = slots;
+		Reserve((slots + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH);
+		spheres.assign(m_capacity, nullptr);
+		for (int i = 0; i < m_capacity; ++i) SetEmpty(i);
+	}
+	void Set(int slot, const Sphere* sphere)
+	{
+		spheres[slot] = sphere;
+		m_centerX[slot] = sphere->center.x;
+		m_centerY[slot] = sphere->center.y;
+		m_centerZ[slot] = sphere->center.z;
+		m_radius2[slot] = sphere->radius2;
+	}
+	void SetEmpty(int slot)
+	{
+		//negative radius^2 makes the empty lanes fail the d2 > radius2 test
+		spheres[slot] = nullptr;
+		m_centerX[slot] = m_centerY[slot] = m_centerZ[slot] = 0;
+		m_radius2[slot] = -1;
+	}
+
+	int count() const { return m_count; }
+
+	//[comment]
+	// Closest-hit query. Same maths as Sphere::intersect, evaluated for SIMD_WIDTH spheres at once.
+	// tnear holds the current closest distance on entry and is only overwritten, together with
+	// index, if a closer sphere is found. Ties resolve to the lowest index like the scalar loop.
+	// The range versions test slots [first, last), first has to be a multiple of SIMD_WIDTH.
+	//[/comment]
+	bool Intersect(const Vec3f& rayorig, const Vec3f& raydir, float& tnear, int& index) const
+	{
+		return IntersectRange(rayorig, raydir, 0, m_count, tnear, index);
+	}
+	bool IntersectRange(const Vec3f& rayorig, const Vec3f& raydir, int first, int last, float& tnear, int& index) const
+	{
+		SimdFloat ox = SimdSet(rayorig.x), oy = SimdSet(rayorig.y), oz = SimdSet(rayorig.z);
+		SimdFloat dx = SimdSet(raydir.x), dy = SimdSet(raydir.y), dz = SimdSet(raydir.z);
+		SimdFloat zero = SimdSet(0);
+		SimdFloat bestT = SimdSet(tnear);
+		SimdInt bestIndex = SimdSetInt(-1);
+		SimdInt laneIndex = SimdAddInt(SimdLaneIndices(), SimdSetInt(first));
+		SimdInt step = SimdSetInt(SIMD_WIDTH);
+
+		for (int i = first; i < last; i += SIMD_WIDTH, laneIndex = SimdAddInt(laneIndex, step)) {
+			SimdFloat lx = SimdSub(SimdLoad(m_centerX + i), ox);
+			SimdFloat ly = SimdSub(SimdLoad(m_centerY + i), oy);
+			SimdFloat lz = SimdSub(SimdLoad(m_centerZ + i), oz);
+			SimdFloat r2 = SimdLoad(m_radius2 + i);
+			SimdFloat tca = SimdAdd(SimdAdd(SimdMul(lx, dx), SimdMul(ly, dy)), SimdMul(lz, dz));
+			SimdFloat d2 = SimdSub(SimdAdd(SimdAdd(SimdMul(lx, lx), SimdMul(ly, ly)), SimdMul(lz, lz)), SimdMul(tca, tca));
+			SimdFloat hit = SimdAnd(SimdGreaterEqual(tca, zero), SimdLessEqual(d2, r2));
+			if (SimdMoveMask(hit) == 0) continue;
+
+			SimdFloat thc = SimdSqrt(SimdMax(SimdSub(r2, d2), zero));
+			SimdFloat t0 = SimdSub(tca, thc);
+			SimdFloat t1 = SimdAdd(tca, thc);
+			SimdFloat t = SimdSelect(SimdLess(t0, zero), t0, t1); //if (t0 < 0) t0 = t1;
+			SimdFloat closer = SimdAnd(hit, SimdLess(t, bestT));
+			bestT = SimdSelect(closer, bestT, t);
+			bestIndex = SimdSelectInt(closer, bestIndex, laneIndex);
+		}
+
+		alignas(32) float laneT[SIMD_WIDTH];
+		alignas(32) int laneIndices[SIMD_WIDTH];
+		SimdStore(laneT, bestT);
+		SimdStoreInt(laneIndices, bestIndex);
+
+		bool found = false;
+		for (int lane = 0; lane < SIMD_WIDTH; ++lane) {
+			if (laneIndices[lane] < 0) continue;
+			if (laneT[lane] < tnear || (laneT[lane] == tnear && found && laneIndices[lane] < index)) {
+				tnear = laneT[lane];
+				index = laneIndices[lane];
+				found = true;
+			}
+		}
+		return found;
+	}
+
+	//[comment]
+	// Closest-hit query for a whole packet. Each sphere is loaded once and tested against all rays
+	// of the packet, SIMD_WIDTH rays per instruction. Since the rays share an origin the vector
+	// to the sphere centre and its squared length are computed once per sphere.
+	// tnear and index hold PACKET_SIZE entries and are only overwritten for rays that find a closer
+	// sphere, so index should start at -1.
+	//[/comment]
+	void IntersectPacket(const RayPacket& packet, float* tnear, int* index) const
+	{
+		IntersectPacketRange(packet, 0, m_count, tnear, index);
+	}
+	void IntersectPacketRange(const RayPacket& packet, int first, int last, float* tnear, int* index) const
+	{
+		const int chunks = PACKET_SIZE / SIMD_WIDTH;
+		SimdFloat dx[chunks], dy[chunks], dz[chunks], bestT[chunks];
+		SimdInt bestIndex[chunks];
+		SimdFloat zero = SimdSet(0);
+		for (int c = 0; c < chunks; ++c) {
+			dx[c] = SimdLoad(packet.dirX + c * SIMD_WIDTH);
+			dy[c] = SimdLoad(packet.dirY + c * SIMD_WIDTH);
+			dz[c] = SimdLoad(packet.dirZ + c * SIMD_WIDTH);
+			bestT[c] = SimdLoad(tnear + c * SIMD_WIDTH);
+			bestIndex[c] = SimdLoadInt(index + c * SIMD_WIDTH);
+		}
+
+		for (int i = first; i < last; ++i) {
+			float lxs = m_centerX[i] - packet.origin.x;
+			float lys = m_centerY[i] - packet.origin.y;
+			float lzs = m_centerZ[i] - packet.origin.z;
+			SimdFloat lx = SimdSet(lxs), ly = SimdSet(lys), lz = SimdSet(lzs);
+			SimdFloat ll = SimdSet(lxs * lxs + lys * lys + lzs * lzs);
+			SimdFloat r2 = SimdSet(m_radius2[i]);
+			SimdInt sphereIndex = SimdSetInt(i);
+
+			for (int c = 0; c < chunks; ++c) {
+				SimdFloat tca = SimdAdd(SimdAdd(SimdMul(lx, dx[c]), SimdMul(ly, dy[c])), SimdMul(lz, dz[c]));
+				SimdFloat d2 = SimdSub(ll, SimdMul(tca, tca));
+				SimdFloat hit = SimdAnd(SimdGreaterEqual(tca, zero), SimdLessEqual(d2, r2));
+				if (SimdMoveMask(hit) == 0) continue;
+
+				SimdFloat thc = SimdSqrt(SimdMax(SimdSub(r2, d2), zero));
+				SimdFloat t0 = SimdSub(tca, thc);
+				SimdFloat t1 = SimdAdd(tca, thc);
+				SimdFloat t = SimdSelect(SimdLess(t0, zero), t0, t1); //if (t0 < 0) t0 = t1;
+				SimdFloat closer = SimdAnd(hit, SimdLess(t, bestT[c]));
+				bestT[c] = SimdSelect(closer, bestT[c], t);
+				bestIndex[c] = SimdSelectInt(closer, bestIndex[c], sphereIndex);
+			}
+		}
+
+		for (int c = 0; c < chunks; ++c) {
+			SimdStore(tnear + c * SIMD_WIDTH, bestT[c]);
+			SimdStoreInt(index + c * SIMD_WIDTH, bestIndex[c]);
+		}
+	}
+
+	//[comment]
+	// Any-hit query for the shadow loop, true as soon as any sphere except skipIndex blocks the ray
+	// before tmax. Same test as Sphere::occluded, so no square root is taken.
+	//[/comment]
+	bool Occluded(const Vec3f& rayorig, const Vec3f& raydir, float tmax, int skipIndex) const
+	{
+		return OccludedRange(rayorig, raydir, tmax, 0, m_count, skipIndex);
+	}
+	//blocker, if given, receives the index of the sphere that was found blocking the ray
+	bool OccludedRange(const Vec3f& rayorig, const Vec3f& raydir, float tmax, int first, int last, int skipIndex, int* blocker = nullptr) const
+	{
+		SimdFloat ox = SimdSet(rayorig.x), oy = SimdSet(rayorig.y), oz = SimdSet(rayorig.z);
+		SimdFloat dx = SimdSet(raydir.x), dy = SimdSet(raydir.y), dz = SimdSet(raydir.z);
+		SimdFloat zero = SimdSet(0);
+		SimdFloat maxT = SimdSet(tmax);
+
+		for (int i = first; i < last; i += SIMD_WIDTH) {
+			SimdFloat lx = SimdSub(SimdLoad(m_centerX + i), ox);
+			SimdFloat ly = SimdSub(SimdLoad(m_centerY + i), oy);
+			SimdFloat lz = SimdSub(SimdLoad(m_centerZ + i), oz);
+			SimdFloat tca = SimdAdd(SimdAdd(SimdMul(lx, dx), SimdMul(ly, dy)), SimdMul(lz, dz));
+			SimdFloat d2 = SimdSub(SimdAdd(SimdAdd(SimdMul(lx, lx), SimdMul(ly, ly)), SimdMul(lz, lz)), SimdMul(tca, tca));
+			SimdFloat r2 = SimdLoad(m_radius2 + i);
+			//the entry point is closer than tmax if tca - tmax < 0 or (tca - tmax)^2 < radius2 - d2
+			SimdFloat beyond = SimdSub(tca, maxT);
+			SimdFloat beforeMax = SimdOr(SimdLess(beyond, zero), SimdLess(SimdMul(beyond, beyond), SimdSub(r2, d2)));
+			int mask = SimdMoveMask(SimdAnd(SimdAnd(SimdGreaterEqual(tca, zero), SimdLessEqual(d2, r2)), beforeMax));
+			//drop the lane of the sphere that is being tested against (the light itself)
+			if (skipIndex >= i && skipIndex < i + SIMD_WIDTH) mask &= ~(1 << (skipIndex - i));
+			if (mask != 0) {
+				if (blocker) {
+					int lane = 0;
+					while (!(mask & (1 << lane))) lane++;
+					*blocker = i + lane;
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+};
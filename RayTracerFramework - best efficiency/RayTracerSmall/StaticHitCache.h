@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include "PixelBuffer.h"
+
+//[comment]
+// Closest static hit of one ray of a pixel's ray tree. node is the ray's position in the tree: the
+// camera ray is 1 and the reflection and refraction rays of node n are 2n and 2n + 1. slot is the
+// static BVH slot that was hit, -1 if the ray missed every static sphere.
+//[/comment]
+struct StaticHit
+{
+	int node;
+	int slot;
+	float tnear;
+};
+
+//the cached hits of one pixel, count of them starting at first in the list of its row
+struct StaticHitRange
+{
+	unsigned first, count;
+};
+
+//the cached hit of a node, nullptr if the node is not in the static ray tree of the pixel
+inline const StaticHit* FindStaticHit(const StaticHit* hits, unsigned count, int node)
+{
+	for (unsigned i = 0; i < count; ++i) {
+		if (hits[i].node == node) return hits + i;
+	}
+	return nullptr;
+}
+
+//[comment]
+// Closest static hits of every ray of every pixel, kept across frames. A ray whose ancestors all
+// hit static spheres is the same ray every frame, so its static hit only has to be found once and
+// from then on only the dynamic spheres are intersected with it. The hits of a pixel are recorded
+// by tracing it against the static spheres alone, which gives exactly those rays. Like the
+// DependencyBuffer the hits are kept per image row so the render threads never share a list, and
+// they are only valid for the static BVH build they were recorded with (the version of the
+// PixelBuffer is the static build count).
+//[/comment]
+class StaticHitCache : public PixelBuffer<StaticHitRange>
+{
+public:
+	std::vector<std::vector<StaticHit>> rowHits;
+
+	void Resize(unsigned width, unsigned height)
+	{
+		if (PixelBuffer::Resize(width, height)) rowHits.assign(height, std::vector<StaticHit>());
+	}
+};
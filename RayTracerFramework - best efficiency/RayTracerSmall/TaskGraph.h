@@ -0,0 +1,87 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "ThreadPool.h"
+
+//[comment]
+// Dependency graph of jobs run on a ThreadPool. Add creates a task, Precede(a, b) adds the edge
+// "a has to finish before b starts". Run submits every task without dependencies and each task
+// that finishes submits the successors it was the last dependency of, so independent stages (the
+// file write of one frame and the tracing of the next) run side by side on the same workers.
+// Run returns once every task has finished; the graph can then be cleared and built again.
+//[/comment]
+class TaskGraph
+{
+private:
+	struct Task
+	{
+		std::function<void()> work;
+		int worker; //pool worker the task has to run on, -1 for any
+		std::vector<int> successors;
+		int dependencyCount;
+		std::atomic<int> pending; //dependencies that haven't finished yet during Run
+	};
+	std::deque<Task> m_tasks; //a deque never moves its tasks, the atomics can't be moved
+	ThreadPool* m_pool;
+	std::mutex m_mutex;
+	std::condition_variable m_allDone;
+	int m_finished;
+
+	void Launch(int index)
+	{
+		int worker = m_tasks[index].worker;
+		if (worker >= 0) m_pool->SubmitTo(worker, [this, index]() { Execute(index); });
+		else m_pool->Submit([this, index]() { Execute(index); });
+	}
+	void Execute(int index)
+	{
+		Task& task = m_tasks[index];
+		task.work();
+		for (int successor : task.successors) {
+			if (--m_tasks[successor].pending == 0) Launch(successor);
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (++m_finished == (int)m_tasks.size()) m_allDone.notify_all();
+	}
+public:
+	TaskGraph() : m_pool(nullptr), m_finished(0) {}
+	TaskGraph(const TaskGraph&) = delete;
+	TaskGraph& operator=(const TaskGraph&) = delete;
+
+	//worker ties the task to one worker of the pool (see ThreadPool::SubmitTo)
+	int Add(std::function<void()> work, int worker = -1)
+	{
+		m_tasks.emplace_back();
+		Task& task = m_tasks.back();
+		task.work = std::move(work);
+		task.worker = worker;
+		task.dependencyCount = 0;
+		return (int)m_tasks.size() - 1;
+	}
+	//negative indices are ignored, so optional stages (the previous frame of the first frame) need no special case
+	void Precede(int before, int after)
+	{
+		if (before < 0 || after < 0) return;
+		m_tasks[before].successors.push_back(after);
+		m_tasks[after].dependencyCount++;
+	}
+	int Size() const { return (int)m_tasks.size(); }
+	void Clear() { m_tasks.clear(); }
+
+	void Run(ThreadPool& pool)
+	{
+		if (m_tasks.empty()) return;
+		m_pool = &pool;
+		m_finished = 0;
+		for (Task& task : m_tasks) task.pending = task.dependencyCount;
+		for (int i = 0; i < (int)m_tasks.size(); ++i) {
+			if (m_tasks[i].dependencyCount == 0) Launch(i);
+		}
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_allDone.wait(lock, [this] { return m_finished == (int)m_tasks.size(); });
+	}
+};
@@ -0,0 +1,123 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include "Affinity.h"
+
+//[comment]
+// Fixed set of worker threads that live as long as the pool. Jobs are queued with Submit and run
+// in submission order by whichever worker is free; Wait blocks until every submitted job has
+// finished, which is how a frame waits for its bands. Creating the threads once replaces spawning
+// and joining a new set for every frame. The destructor lets the queued jobs finish and joins
+// the workers.
+// The default size is one worker per hardware thread.
+// With pinWorkers every worker is pinned to its own logical processor and records its NUMA node.
+// The processors are taken from the process affinity mask (AllowedCpus) in order, so a run
+// limited to some cores keeps its workers on those; with more workers than processors they wrap.
+// SubmitTo queues a job for one specific worker, so work that has to stay next to the memory a
+// worker first touched (a band of the framebuffer) keeps running on that worker's node.
+//[/comment]
+class ThreadPool
+{
+private:
+	std::vector<std::thread> m_workers;
+	std::deque<std::function<void()>> m_jobs;
+	std::vector<std::deque<std::function<void()>>> m_workerJobs; //jobs for one specific worker
+	std::vector<int> m_workerNodes;
+	std::mutex m_mutex;
+	std::condition_variable m_jobReady;
+	std::condition_variable m_allDone;
+	int m_unfinished; //queued plus running jobs
+	bool m_stopping;
+
+	//cpu is the logical processor to pin the worker to, -1 if it isn't known
+	void WorkerLoop(int index, bool pin, int cpu)
+	{
+		if (pin) {
+			int node = PinThisThread(cpu) ? CurrentNumaNode() : -1;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_workerNodes[index] = node;
+			if (--m_unfinished == 0) m_allDone.notify_all(); //the constructor waits for every worker to be placed
+		}
+		std::deque<std::function<void()>>& ownJobs = m_workerJobs[index];
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true) {
+			m_jobReady.wait(lock, [&] { return m_stopping || !m_jobs.empty() || !ownJobs.empty(); });
+			std::deque<std::function<void()>>& jobs = ownJobs.empty() ? m_jobs : ownJobs;
+			if (jobs.empty()) return; //only when stopping
+			std::function<void()> job = std::move(jobs.front());
+			jobs.pop_front();
+			lock.unlock();
+			job();
+			lock.lock();
+			if (--m_unfinished == 0) m_allDone.notify_all();
+		}
+	}
+public:
+	static int DefaultSize()
+	{
+		unsigned hardwareThreads = std::thread::hardware_concurrency();
+		return hardwareThreads > 0 ? (int)hardwareThreads : 1; //0 means the count is unknown
+	}
+
+	explicit ThreadPool(int size = DefaultSize(), bool pinWorkers = false) : m_workerJobs(size), m_workerNodes(size, -1), m_unfinished(pinWorkers ? size : 0), m_stopping(false)
+	{
+		std::vector<int> cpus;
+		if (pinWorkers) cpus = AllowedCpus();
+		m_workers.reserve(size);
+		for (int i = 0; i < size; ++i) {
+			int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+			m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i, pinWorkers, cpu);
+		}
+		Wait();
+	}
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_jobReady.notify_all();
+		for (std::thread& worker : m_workers) worker.join();
+	}
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int Size() const { return (int)m_workers.size(); }
+	//NUMA node of a pinned worker, -1 if the workers aren't pinned
+	int WorkerNode(int worker) const { return m_workerNodes[worker]; }
+	int NodeCount() const
+	{
+		int nodes = 1;
+		for (int node : m_workerNodes) nodes = std::max(nodes, node + 1);
+		return nodes;
+	}
+
+	void Submit(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.push_back(std::move(job));
+			m_unfinished++;
+		}
+		m_jobReady.notify_one();
+	}
+	void SubmitTo(int worker, std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_workerJobs[worker].push_back(std::move(job));
+			m_unfinished++;
+		}
+		m_jobReady.notify_all(); //only that worker may take it
+	}
+	void Wait()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_allDone.wait(lock, [this] { return m_unfinished == 0; });
+	}
+};
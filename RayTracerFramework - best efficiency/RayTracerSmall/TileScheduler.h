@@ -0,0 +1,188 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+#include <algorithm>
+
+//[comment]
+// Edge length of the square tiles the image is split into for the work-stealing scheduler. Small
+// enough that a frame has a couple of thousand of them to balance with, big enough that handing
+// one out is negligible next to tracing it.
+//[/comment]
+#define TILE_SIZE 32
+
+//[comment]
+// 1 deals the tiles of a frame out by the time they took in the previous frame (see Reset), 0 always
+// deals them out in scanline order.
+//[/comment]
+#define TILE_PREDICTIVE_ORDER 1
+
+//pixel rectangle [x0, x1) x [y0, y1) of the image, index is its position in scanline order
+struct Tile
+{
+	unsigned x0, y0, x1, y1;
+	int index;
+};
+
+//[comment]
+// Hands the tiles of a frame to the render workers. Every worker starts with its own deque holding
+// an even, contiguous share of the tiles in scanline order and takes tiles from its front. A worker
+// whose deque is empty steals from the back of another worker's deque, so the worker that got the
+// reflective spheres is helped out by the one that got the sky, and the load balance no longer
+// depends on the scene layout.
+// The time every worker spent rendering tiles (busy) and not (idle, waiting for the frame to end)
+// is measured so the balance can be checked.
+// In an animation a tile costs about the same in consecutive frames, so the time each tile took is
+// kept for the next frame, which deals the tiles out longest first (see Reset).
+//[/comment]
+class TileScheduler
+{
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<Tile> tiles;
+		double busySeconds;
+		int rendered, stolen;
+	};
+	std::vector<WorkerQueue> m_queues;
+	std::vector<float> m_tileSeconds; //time every tile took in the last frame, by tile index
+	std::vector<Tile> m_tiles;        //scratch for dealing out
+	std::vector<double> m_predicted;  //scratch, predicted seconds dealt to every worker
+	Clock::time_point m_frameStart;
+	double m_frameSeconds;
+
+	bool Pop(WorkerQueue& queue, bool front, Tile& tile)
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tiles.empty()) return false;
+		if (front) {
+			tile = queue.tiles.front();
+			queue.tiles.pop_front();
+		}
+		else {
+			tile = queue.tiles.back();
+			queue.tiles.pop_back();
+		}
+		return true;
+	}
+public:
+	explicit TileScheduler(int workers) : m_queues(workers), m_frameSeconds(0) {}
+
+	int WorkerCount() const { return (int)m_queues.size(); }
+
+	//[comment]
+	// Splits the next frame into tiles and deals them out, has to be called before the workers start.
+	// If the last frame had the same tiles, they are sorted by the time they took then and dealt out
+	// longest first, each to the worker with the least predicted time so far. Every deque then starts
+	// with its most expensive tiles, the partitions are balanced by predicted cost rather than tile
+	// count, and what is left to steal at the end of the frame are the cheapest tiles. Otherwise
+	// every worker gets a contiguous band of tiles.
+	//[/comment]
+	void Reset(unsigned width, unsigned height)
+	{
+		int workers = WorkerCount();
+		for (int i = 0; i < workers; ++i) {
+			WorkerQueue& queue = m_queues[i];
+			queue.tiles.clear();
+			queue.busySeconds = 0;
+			queue.rendered = queue.stolen = 0;
+		}
+		m_tiles.clear();
+		for (unsigned y = 0; y < height; y += TILE_SIZE) {
+			for (unsigned x = 0; x < width; x += TILE_SIZE) {
+				Tile tile;
+				tile.x0 = x;
+				tile.y0 = y;
+				tile.x1 = std::min(x + TILE_SIZE, width);
+				tile.y1 = std::min(y + TILE_SIZE, height);
+				tile.index = (int)m_tiles.size();
+				m_tiles.push_back(tile);
+			}
+		}
+		int tileCount = (int)m_tiles.size();
+
+		if (!TILE_PREDICTIVE_ORDER || (int)m_tileSeconds.size() != tileCount) {
+			m_tileSeconds.assign(tileCount, 0);
+			for (int i = 0; i < tileCount; ++i) {
+				m_queues[(long long)i * workers / tileCount].tiles.push_back(m_tiles[i]);
+			}
+		}
+		else {
+			const std::vector<float>& seconds = m_tileSeconds;
+			std::stable_sort(m_tiles.begin(), m_tiles.end(), [&](const Tile& a, const Tile& b) { return seconds[a.index] > seconds[b.index]; });
+			m_predicted.assign(workers, 0);
+			for (const Tile& tile : m_tiles) {
+				//ties go to the worker with fewer tiles, so tiles that were never timed are dealt round robin
+				int target = 0;
+				for (int i = 1; i < workers; ++i) {
+					if (m_predicted[i] < m_predicted[target] ||
+						(m_predicted[i] == m_predicted[target] && m_queues[i].tiles.size() < m_queues[target].tiles.size())) target = i;
+				}
+				m_queues[target].tiles.push_back(tile);
+				m_predicted[target] += seconds[tile.index];
+			}
+		}
+		m_frameStart = Clock::now();
+	}
+
+	//[comment]
+	// Next tile for worker, from its own deque or stolen from the others. Returns false once every
+	// deque is empty, the frame is then finished as far as this worker is concerned.
+	//[/comment]
+	bool Next(int worker, Tile& tile)
+	{
+		if (Pop(m_queues[worker], true, tile)) return true;
+		int workers = WorkerCount();
+		for (int i = 1; i < workers; ++i) {
+			if (Pop(m_queues[(worker + i) % workers], false, tile)) {
+				m_queues[worker].stolen++;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//renders every tile worker gets with renderTile(tile), timing the work
+	template <class RenderTile>
+	void Run(int worker, RenderTile renderTile)
+	{
+		WorkerQueue& queue = m_queues[worker];
+		Tile tile;
+		while (Next(worker, tile)) {
+			Clock::time_point start = Clock::now();
+			renderTile(tile);
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			m_tileSeconds[tile.index] = (float)seconds; //every tile is rendered once, so the workers never write the same entry
+			queue.busySeconds += seconds;
+			queue.rendered++;
+		}
+	}
+
+	//called once all workers have returned, closes the frame for the idle times
+	void EndFrame() { m_frameSeconds = std::chrono::duration<double>(Clock::now() - m_frameStart).count(); }
+
+	int TilesRendered() const
+	{
+		int rendered = 0;
+		for (const WorkerQueue& queue : m_queues) rendered += queue.rendered;
+		return rendered;
+	}
+
+	//busy/idle milliseconds and rendered(stolen) tiles of every worker of the last frame
+	void Report(std::ostream& out) const
+	{
+		out << "Tiles per worker, busy/idle ms:";
+		for (unsigned i = 0; i < m_queues.size(); ++i) {
+			const WorkerQueue& queue = m_queues[i];
+			double idleSeconds = std::max(0.0, m_frameSeconds - queue.busySeconds);
+			out << " [" << i << "] " << queue.rendered << "(" << queue.stolen << ") "
+				<< (int)(queue.busySeconds * 1000) << "/" << (int)(idleSeconds * 1000);
+		}
+		out << std::endl;
+	}
+};
@@ -36,9 +36,24 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <functional>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 
 #include "MemoryDebugger.h"
 #include "MemoryPool.h"
+#include "CompiledScene.h"
+#include "RayQueue.h"
+#include "DependencyBuffer.h"
+#include "StaticHitCache.h"
+#include "GBuffer.h"
+#include "ThreadPool.h"
+#include "TileScheduler.h"
+#include "TaskGraph.h"
+#include "FiberScheduler.h"
+#include "LinearAllocator.h"
+#include "PerfCounters.h"
 
 #if defined __linux__ || defined __APPLE__
 // "Compiled for Linux
@@ -53,48 +68,38 @@ typedef Vec3<float> Vec3f;
 //[comment]
 // This variable controls the maximum recursion depth
 //[/comment]
+#ifndef MAX_RAY_DEPTH
 #define MAX_RAY_DEPTH 5
+#endif
 
 float mix(const float& a, const float& b, const float& mix)
 {
 	return b * mix + a * (1 - mix);
 }
 
+/////////////////////////////////////////////////////// my edit
+Vec3f traceRecursive(
+	const Vec3f& rayorig,
+	const Vec3f& raydir,
+	const CompiledScene& scene,
+	const int& depth);
+
 //[comment]
-// This is the main trace function. It takes a ray as argument (defined by its origin
-// and direction). We test if this ray intersects any of the geometry in the scene.
-// If the ray intersects an object, we compute the intersection point, the normal
-// at the intersection point, and shade this point using this information.
-// Shading depends on the surface property (is it transparent, reflective, diffuse).
-// The function returns a color for the ray. If the ray intersects an object that
-// is the color of the object at the intersection point, otherwise it returns
-// the background color.
+// Shading half of the recursive trace function below. The closest hit (sphere index and distance)
+// has already been found by traceRecursive.
 //[/comment]
-Vec3f trace(
+Vec3f shadeRecursive(
 	const Vec3f& rayorig,
 	const Vec3f& raydir,
-	const std::vector<Sphere>& spheres,
+	const CompiledScene& scene,
+	const int hitIndex,
+	const float tnear,
 	const int& depth)
 {
-	//if (raydir.length() != 1) std::cerr << "Error " << raydir << std::endl;
-	float tnear = INFINITY;
-	const Sphere* sphere = NULL;
-	// find intersection of this ray with the sphere in the scene
-	for (unsigned i = 0; i < spheres.size(); ++i) {
-		float t0 = INFINITY, t1 = INFINITY;
-		if (spheres[i].intersect(rayorig, raydir, t0, t1)) {
-			if (t0 < 0) t0 = t1;
-			if (t0 < tnear) {
-				tnear = t0;
-				sphere = &spheres[i];
-			}
-		}
-	}
-	// if there's no intersection return black or background color
-	if (!sphere) return Vec3f(2);
+	const Material& material = scene.GetMaterial(hitIndex);
 	Vec3f surfaceColor = 0; // color of the ray/surfaceof the object intersected by the ray
 	Vec3f phit = rayorig + raydir * tnear; // point of intersection
-	Vec3f nhit = phit - sphere->center; // normal at the intersection point
+	Vec3f nhit = phit - scene.GetCenter(hitIndex); // normal at the intersection point
 	nhit.normalize(); // normalize normal direction
 	// If the normal and the view direction are not opposite to each other
 	// reverse the normal direction. That also means we are inside the sphere so set
@@ -102,9 +107,9 @@ Vec3f trace(
 	// positive.
 	float bias = 1e-4; // add some bias to the point from which we will be tracing
 	bool inside = false;
-	bool transparent = sphere->transparency > 0;
-	bool reflective = sphere->reflection > 0;
 	if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true;
+	bool transparent = material.transparency > 0;
+	bool reflective = material.reflection > 0;
 	if ((transparent || reflective) && depth < MAX_RAY_DEPTH) {
 		float facingratio = -raydir.dot(nhit);
 		// change the mix value to tweak the effect
@@ -118,159 +123,522 @@ Vec3f trace(
 		//optimization: add reflection values only if reflection is present. Add transparency values only if its present.
 
 		//if reflective, find reflection
-		if (transparent) {
+		if (reflective) {
 			Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
 			refldir.normalize();
-			Vec3f reflection = trace(phit + nhit * bias, refldir, spheres, depth + 1);
+			Vec3f reflection = traceRecursive(phit + nhit * bias, refldir, scene, depth + 1);
 			surfaceColor += reflection * fresneleffect;
 		}
 
 
 		// if the sphere is also transparent compute refraction ray (transmission)
-		if (reflective) {
+		if (transparent) {
 			float ior = 1.1, eta = (inside) ? ior : 1 / ior; // are we inside or outside the surface?
 			float cosi = -nhit.dot(raydir);
 			float k = 1 - eta * eta * (1 - cosi * cosi);
 			Vec3f refrdir = raydir * eta + nhit * (eta * cosi - sqrt(k));
 			refrdir.normalize();
-			refraction = trace(phit - nhit * bias, refrdir, spheres, depth + 1);
-			surfaceColor += refraction * (1 - fresneleffect) * sphere->transparency;
+			refraction = traceRecursive(phit - nhit * bias, refrdir, scene, depth + 1);
+			surfaceColor += refraction * (1 - fresneleffect) * material.transparency;
 		}
 
 		// the result is a mix of reflection and refraction (if the sphere is transparent)
-		surfaceColor *= sphere->surfaceColor;
+		surfaceColor *= material.surfaceColor;
 	}
 	else {
 		// it's a diffuse object, no need to raytrace any further
-		for (unsigned i = 0; i < spheres.size(); ++i) {
-			if (spheres[i].emissionColor.x > 0) {
-				// this is a light
-				Vec3f transmission = 1;
-				Vec3f lightDirection = spheres[i].center - phit;
-				lightDirection.normalize();
-				for (unsigned j = 0; j < spheres.size(); ++j) {
-					if (i != j) {
-						float t0, t1;
-						if (spheres[j].intersect(phit + nhit * bias, lightDirection, t0, t1)) {
-							transmission = 0;
-							break;
-						}
-					}
-				}
-				surfaceColor += sphere->surfaceColor * transmission *
-					std::max(float(0), nhit.dot(lightDirection)) * spheres[i].emissionColor;
+		//optimization: only the precomputed lights are visited, and scenes without lights skip the loop
+		for (const Light& light : scene.GetLights()) {
+			Vec3f transmission = 1;
+			Vec3f lightDirection = light.center - phit;
+			float lightDistance = lightDirection.length(); //spheres behind the light don't cast a shadow
+			lightDirection.normalize();
+			//optimization: any-hit BVH traversal, stops at the first sphere that blocks the light
+			if (scene.Occluded(phit + nhit * bias, lightDirection, lightDistance, light.slot)) {
+				transmission = 0;
 			}
+			surfaceColor += material.surfaceColor * transmission *
+				std::max(float(0), nhit.dot(lightDirection)) * light.emissionColor;
 		}
 	}
 
-	return surfaceColor + sphere->emissionColor;
+	return surfaceColor + material.emissionColor;
 }
-/////////////////////////////////////////////////////// my edit
-Vec3f trace(
+
+//[comment]
+// This is the original recursive trace function. It takes a ray as argument (defined by its origin
+// and direction) and returns its colour: the colour of the object it hits at the intersection
+// point, or the background colour. The closest hit and the shadow rays are found by traversing the
+// BVH of the compiled scene. Only kept as the reference the iterative trace below is compared
+// against (see TraceComparison), every renderer uses the iterative one.
+//[/comment]
+Vec3f traceRecursive(
 	const Vec3f& rayorig,
 	const Vec3f& raydir,
-	const std::vector<Sphere*>& spheres,
+	const CompiledScene& scene,
 	const int& depth)
 {
 	//if (raydir.length() != 1) std::cerr << "Error " << raydir << std::endl;
 	float tnear = INFINITY;
-	const Sphere* sphere = NULL;
+	int hitIndex = -1;
 	// find intersection of this ray with the sphere in the scene
+	// if there's no intersection return black or background color
+	if (!scene.Intersect(rayorig, raydir, tnear, hitIndex)) return Vec3f(2);
+	return shadeRecursive(rayorig, raydir, scene, hitIndex, tnear, depth);
+}
 
-	for (unsigned i = 0; i < spheres.size(); ++i) {
-		float t0 = INFINITY, t1 = INFINITY;
-		if (spheres[i]->intersect(rayorig, raydir, t0, t1)) {
-			if (t0 < 0) t0 = t1;
-			if (t0 < tnear) {
-				tnear = t0;
-				sphere = spheres[i];
-			}
+//[comment]
+// Size of the explicit ray stack. A hit that spawns two rays keeps following the first one and
+// only pushes the second, so at most one ray per bounce level is ever waiting.
+//[/comment]
+#define TRACE_STACK_SIZE (MAX_RAY_DEPTH + 1)
+
+//[comment]
+// A ray of the iterative trace. weight is the product of the fresnel/transparency factors and
+// surface colours of every hit above it, so whatever the ray finds is added straight into the
+// pixel instead of being returned up a chain of calls. node is the position of the ray in the
+// ray tree (see StaticHit), 0 once the static hit cache doesn't know the ray.
+//[/comment]
+struct PendingRay
+{
+	Vec3f origin, direction, weight;
+	int depth;
+	int node;
+};
+
+//[comment]
+// Adaptive ray termination. A reflection or refraction ray is not traced at all if its weight
+// (largest component) times the brightest colour it could bring back (CompiledScene::GetRadianceBound)
+// is below RAY_CONTRIBUTION_EPSILON. The default keeps every culled ray below half an 8 bit step of
+// the pixel, in scenes with lights too. 0 traces every ray down to MAX_RAY_DEPTH.
+//[/comment]
+#ifndef RAY_CONTRIBUTION_EPSILON
+#define RAY_CONTRIBUTION_EPSILON (0.5f / 255)
+#endif
+
+//[comment]
+// Secondary rays traced and culled by the adaptive termination. Every render thread counts into
+// its own copy and adds it to the totals when it has finished its band.
+//[/comment]
+struct RayCounters
+{
+	unsigned long long traced = 0, culled = 0;
+};
+thread_local RayCounters threadRayCounters;
+std::atomic<unsigned long long> totalTracedRays(0), totalCulledRays(0);
+
+void FlushRayCounters()
+{
+	totalTracedRays += threadRayCounters.traced;
+	totalCulledRays += threadRayCounters.culled;
+	threadRayCounters = RayCounters();
+}
+
+//true if a secondary ray with this weight is worth tracing in the scene
+inline bool KeepRay(const Vec3f& weight, const CompiledScene& scene)
+{
+	if (std::max(weight.x, std::max(weight.y, weight.z)) * scene.GetRadianceBound() >= RAY_CONTRIBUTION_EPSILON) {
+		threadRayCounters.traced++;
+		return true;
+	}
+	threadRayCounters.culled++;
+	return false;
+}
+
+//[comment]
+// Shades one hit of the iterative trace. The diffuse and emitted light is added to color scaled by
+// the ray weight. If the surface spawns secondary rays, ray is turned into the first of them and
+// true is returned, the refraction ray of a surface that also reflects is pushed on the stack.
+// Secondary rays too weak to change the pixel are dropped (see RAY_CONTRIBUTION_EPSILON).
+// If dependencies is given, the spheres and lights the hit depends on are added to it.
+// shadeSurface is the same for a hit whose point and normal are already known.
+//[/comment]
+bool shadeSurface(
+	PendingRay& ray,
+	const CompiledScene& scene,
+	const int hitIndex,
+	const Vec3f& phit,
+	Vec3f nhit,
+	Vec3f& color,
+	PendingRay* stack,
+	int& stackSize,
+	DependencyRecorder* dependencies = nullptr)
+{
+	const Material& material = scene.GetMaterial(hitIndex);
+	if (dependencies) dependencies->AddSphere(hitIndex);
+	float bias = 1e-4; // add some bias to the point from which we will be tracing
+	bool inside = false;
+	if (ray.direction.dot(nhit) > 0) nhit = -nhit, inside = true;
+	bool transparent = material.transparency > 0;
+	bool reflective = material.reflection > 0;
+	color += ray.weight * material.emissionColor;
+	if ((transparent || reflective) && ray.depth < MAX_RAY_DEPTH) {
+		float facingratio = -ray.direction.dot(nhit);
+		// change the mix value to tweak the effect
+		float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
+		// the result is a mix of reflection and refraction, tinted by the surface color
+		Vec3f surfaceWeight = ray.weight * material.surfaceColor;
+		Vec3f raydir = ray.direction;
+		int node = ray.node;
+		ray.depth++;
+
+		//optimization: rays that can't change the 8 bit pixel any more are not traced
+		Vec3f refractionWeight, reflectionWeight;
+		bool traceRefraction = false, traceReflection = false;
+		if (transparent) {
+			refractionWeight = surfaceWeight * ((1 - fresneleffect) * material.transparency);
+			traceRefraction = KeepRay(refractionWeight, scene);
 		}
+		if (reflective) {
+			reflectionWeight = surfaceWeight * fresneleffect;
+			traceReflection = KeepRay(reflectionWeight, scene);
+		}
+
+		if (traceRefraction) {
+			float ior = 1.1, eta = (inside) ? ior : 1 / ior; // are we inside or outside the surface?
+			float cosi = -nhit.dot(raydir);
+			float k = 1 - eta * eta * (1 - cosi * cosi);
+			PendingRay& refraction = traceReflection ? stack[stackSize++] : ray;
+			refraction.direction = raydir * eta + nhit * (eta * cosi - sqrt(k));
+			refraction.direction.normalize();
+			refraction.origin = phit - nhit * bias;
+			refraction.weight = refractionWeight;
+			refraction.depth = ray.depth;
+			refraction.node = node ? node * 2 + 1 : 0;
+		}
+		if (traceReflection) {
+			ray.direction = raydir - nhit * 2 * raydir.dot(nhit);
+			ray.direction.normalize();
+			ray.origin = phit + nhit * bias;
+			ray.weight = reflectionWeight;
+			ray.node = node ? node * 2 : 0;
+		}
+		return traceRefraction || traceReflection;
 	}
-	// if there's no intersection return black or background color
-	if (!sphere) return Vec3f(2);
+
+	// it's a diffuse object, no need to raytrace any further
+	for (const Light& light : scene.GetLights()) {
+		Vec3f lightDirection = light.center - phit;
+		float lightDistance = lightDirection.length(); //spheres behind the light don't cast a shadow
+		lightDirection.normalize();
+		int blocker = -1;
+		if (!scene.Occluded(phit + nhit * bias, lightDirection, lightDistance, light.slot, dependencies ? &blocker : nullptr)) {
+			color += ray.weight * material.surfaceColor *
+				std::max(float(0), nhit.dot(lightDirection)) * light.emissionColor;
+		}
+		if (dependencies) {
+			dependencies->AddSphere(light.slot);
+			if (blocker >= 0) dependencies->AddSphere(blocker);
+			dependencies->AddRay(phit + nhit * bias, lightDirection, lightDistance);
+		}
+	}
+	return false;
+}
+bool shadeHit(
+	PendingRay& ray,
+	const CompiledScene& scene,
+	const int hitIndex,
+	const float tnear,
+	Vec3f& color,
+	PendingRay* stack,
+	int& stackSize,
+	DependencyRecorder* dependencies = nullptr)
+{
+	Vec3f phit = ray.origin + ray.direction * tnear; // point of intersection
+	Vec3f nhit = phit - scene.GetCenter(hitIndex); // normal at the intersection point
+	nhit.normalize(); // normalize normal direction
+	return shadeSurface(ray, scene, hitIndex, phit, nhit, color, stack, stackSize, dependencies);
+}
+
+//follows ray and then every ray left on the stack until all of them have been resolved
+Vec3f traceStack(PendingRay& ray, PendingRay* stack, int stackSize, const CompiledScene& scene, Vec3f color, DependencyRecorder* dependencies = nullptr)
+{
+	while (true) {
+		float tnear = INFINITY;
+		int hitIndex = -1;
+		// if there's no intersection add the background color
+		bool follow = false;
+		bool hit = scene.Intersect(ray.origin, ray.direction, tnear, hitIndex);
+		if (dependencies) dependencies->AddRay(ray.origin, ray.direction, tnear);
+		if (hit) {
+			follow = shadeHit(ray, scene, hitIndex, tnear, color, stack, stackSize, dependencies);
+		}
+		else {
+			color += ray.weight * Vec3f(2);
+		}
+		if (!follow) {
+			if (stackSize == 0) return color;
+			ray = stack[--stackSize];
+		}
+	}
+}
+
+//[comment]
+// Non-recursive version of the trace function. The ray keeps following its first child and the
+// second child of a surface that both reflects and refracts waits on a small fixed-size stack
+// with its accumulated weight. That is one stack frame per pixel instead of up to 63, and no
+// Vec3f temporaries have to travel back up the call chain.
+// stack has to hold TRACE_STACK_SIZE rays. It is owned by the caller and reused for every pixel,
+// since zeroing a fresh array of Vec3f per pixel costs about as much as the recursion it replaces.
+// The result matches traceRecursive up to float rounding (the sums are done in a different order).
+//[/comment]
+Vec3f trace(
+	const Vec3f& rayorig,
+	const Vec3f& raydir,
+	const CompiledScene& scene,
+	PendingRay* stack)
+{
+	PendingRay ray;
+	ray.origin = rayorig;
+	ray.direction = raydir;
+	ray.weight = Vec3f(1);
+	ray.depth = 0;
+	ray.node = 1;
+	return traceStack(ray, stack, 0, scene, Vec3f(0));
+}
+
+//same as trace, for a primary ray whose closest hit was already found by a packet query
+Vec3f traceFromHit(
+	const Vec3f& rayorig,
+	const Vec3f& raydir,
+	const CompiledScene& scene,
+	const int hitIndex,
+	const float tnear,
+	PendingRay* stack,
+	DependencyRecorder* dependencies = nullptr)
+{
+	int stackSize = 0;
+	Vec3f color = 0;
+	PendingRay ray;
+	ray.origin = rayorig;
+	ray.direction = raydir;
+	ray.weight = Vec3f(1);
+	ray.depth = 0;
+	ray.node = 1;
+	if (!shadeHit(ray, scene, hitIndex, tnear, color, stack, stackSize, dependencies)) return color;
+	return traceStack(ray, stack, stackSize, scene, color, dependencies);
+}
+
+template <int Depth>
+Vec3f traceSpecialised(const Vec3f& rayorig, const Vec3f& raydir, const CompiledScene& scene);
+
+//[comment]
+// Shading kernel of one material class at one bounce depth. Class and depth are template
+// arguments, so the transparent/reflective/depth tests of shadeRecursive are constants here and
+// every instantiation compiles to a straight-line kernel that only contains the rays its class
+// spawns. At MAX_RAY_DEPTH every class shades as diffuse, like in the recursive trace.
+//[/comment]
+template <MaterialClass Class, int Depth>
+Vec3f shadeSpecialised(
+	const Vec3f& rayorig,
+	const Vec3f& raydir,
+	const CompiledScene& scene,
+	const int hitIndex,
+	const float tnear)
+{
+	const bool transparent = Class == MATERIAL_REFRACTIVE || Class == MATERIAL_GLASS;
+	const bool reflective = Class == MATERIAL_REFLECTIVE || Class == MATERIAL_GLASS;
+	const bool bounces = (transparent || reflective) && Depth < MAX_RAY_DEPTH;
+	const int nextDepth = Depth < MAX_RAY_DEPTH ? Depth + 1 : MAX_RAY_DEPTH; //stops the instantiation at the last level
+
+	const Material& material = scene.GetMaterial(hitIndex);
 	Vec3f surfaceColor = 0; // color of the ray/surfaceof the object intersected by the ray
 	Vec3f phit = rayorig + raydir * tnear; // point of intersection
-	Vec3f nhit = phit - sphere->center; // normal at the intersection point
+	Vec3f nhit = phit - scene.GetCenter(hitIndex); // normal at the intersection point
 	nhit.normalize(); // normalize normal direction
-	// If the normal and the view direction are not opposite to each other
-	// reverse the normal direction. That also means we are inside the sphere so set
-	// the inside bool to true. Finally reverse the sign of IdotN which we want
-	// positive.
 	float bias = 1e-4; // add some bias to the point from which we will be tracing
 	bool inside = false;
 	if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true;
-	bool transparent = sphere->transparency > 0;
-	bool reflective = sphere->reflection > 0;
-	if ((transparent || reflective) && depth < MAX_RAY_DEPTH) {
+	if (bounces) {
 		float facingratio = -raydir.dot(nhit);
 		// change the mix value to tweak the effect
 		float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
-		// compute reflection direction (not need to normalize because all vectors
-		// are already normalized)
-
-		Vec3f reflection = 0;
-		Vec3f refraction = 0;
-
-		//optimization: add reflection values only if reflection is present. Add transparency values only if its present.
-
-		//if reflective, find reflection
 		if (reflective) {
 			Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
 			refldir.normalize();
-			Vec3f reflection = trace(phit + nhit * bias, refldir, spheres, depth + 1);
+			Vec3f reflection = traceSpecialised<nextDepth>(phit + nhit * bias, refldir, scene);
 			surfaceColor += reflection * fresneleffect;
 		}
-
-
-		// if the sphere is also transparent compute refraction ray (transmission)
 		if (transparent) {
 			float ior = 1.1, eta = (inside) ? ior : 1 / ior; // are we inside or outside the surface?
 			float cosi = -nhit.dot(raydir);
 			float k = 1 - eta * eta * (1 - cosi * cosi);
 			Vec3f refrdir = raydir * eta + nhit * (eta * cosi - sqrt(k));
 			refrdir.normalize();
-			refraction = trace(phit - nhit * bias, refrdir, spheres, depth + 1);
-			surfaceColor += refraction * (1 - fresneleffect) * sphere->transparency;
+			Vec3f refraction = traceSpecialised<nextDepth>(phit - nhit * bias, refrdir, scene);
+			surfaceColor += refraction * (1 - fresneleffect) * material.transparency;
 		}
-
 		// the result is a mix of reflection and refraction (if the sphere is transparent)
-		surfaceColor *= sphere->surfaceColor;
+		surfaceColor *= material.surfaceColor;
 	}
 	else {
 		// it's a diffuse object, no need to raytrace any further
-		for (unsigned i = 0; i < spheres.size(); ++i) {
-			Sphere temp = *spheres[i];
-			if (temp.emissionColor.x > 0) {
-				// this is a light
-				Vec3f transmission = 1;
-				Vec3f lightDirection = temp.center - phit;
-				lightDirection.normalize();
-				for (unsigned j = 0; j < spheres.size(); ++j) {
-					if (i != j) {
-						float t0, t1;
-						if (spheres[j]->intersect(phit + nhit * bias, lightDirection, t0, t1)) {
-							transmission = 0;
-							break;
-						}
-					}
+		for (const Light& light : scene.GetLights()) {
+			Vec3f lightDirection = light.center - phit;
+			float lightDistance = lightDirection.length(); //spheres behind the light don't cast a shadow
+			lightDirection.normalize();
+			if (!scene.Occluded(phit + nhit * bias, lightDirection, lightDistance, light.slot)) {
+				surfaceColor += material.surfaceColor *
+					std::max(float(0), nhit.dot(lightDirection)) * light.emissionColor;
+			}
+		}
+	}
+
+	return surfaceColor + material.emissionColor;
+}
+
+//picks the kernel of the material class the scene compiler assigned to the hit sphere
+template <int Depth>
+Vec3f shadeByClass(
+	const Vec3f& rayorig,
+	const Vec3f& raydir,
+	const CompiledScene& scene,
+	const int hitIndex,
+	const float tnear)
+{
+	switch (scene.GetMaterial(hitIndex).materialClass) {
+	case MATERIAL_REFLECTIVE: return shadeSpecialised<MATERIAL_REFLECTIVE, Depth>(rayorig, raydir, scene, hitIndex, tnear);
+	case MATERIAL_REFRACTIVE: return shadeSpecialised<MATERIAL_REFRACTIVE, Depth>(rayorig, raydir, scene, hitIndex, tnear);
+	case MATERIAL_GLASS: return shadeSpecialised<MATERIAL_GLASS, Depth>(rayorig, raydir, scene, hitIndex, tnear);
+	default: return shadeSpecialised<MATERIAL_DIFFUSE, Depth>(rayorig, raydir, scene, hitIndex, tnear);
+	}
+}
+
+//[comment]
+// Recursive trace built from the specialised kernels. Depth is the bounce level of the ray, so
+// the call tree of one pixel is fixed at compile time: traceSpecialised<0> is the camera ray.
+// Gives the same result as traceRecursive.
+//[/comment]
+template <int Depth>
+Vec3f traceSpecialised(const Vec3f& rayorig, const Vec3f& raydir, const CompiledScene& scene)
+{
+	float tnear = INFINITY;
+	int hitIndex = -1;
+	// if there's no intersection return black or background color
+	if (!scene.Intersect(rayorig, raydir, tnear, hitIndex)) return Vec3f(2);
+	return shadeByClass<Depth>(rayorig, raydir, scene, hitIndex, tnear);
+}
+
+
+//[comment]
+// Pages of the framebuffers and of SmoothScaling's frame memory, see AllocatePages. Huge pages fall
+// back to normal ones where the system has neither hugetlbfs nor transparent huge pages.
+//[/comment]
+#define FRAMEBUFFER_PAGE_POLICY PagePolicy::HugePages
+
+////////////////////////////////////////////////////////////////////////// my edit
+//[comment]
+// The camera of every renderer: at the origin, looking down -z with a 30 degree field of view.
+// Direction(x, y) is the normalized camera ray of pixel (x, y).
+//[/comment]
+struct Camera
+{
+	float invWidth, invHeight; //optimization: rather than multiplying by 2 on every iteration, just do it here once.
+	float angle, angleAndAspect;
+
+	Camera(unsigned width, unsigned height) : invWidth(2 / float(width)), invHeight(2 / float(height))
+	{
+		float fov = 30, aspectratio = width / float(height);
+		angle = tan(M_PI * 0.5 * fov / 180.);
+		angleAndAspect = angle * aspectratio;
+	}
+
+	Vec3f Direction(unsigned x, unsigned y) const
+	{
+		//optimization: removing "+0.5" from xx and yy didnt make a difference to the output image
+		float xx = (x * invWidth - 1) * angleAndAspect;
+		float yy = (1 - y * invHeight) * angle;
+		Vec3f raydir(xx, yy, -1);
+		raydir.normalize();
+		return raydir;
+	}
+};
+
+//rows [startRow, endRow) of band thisSubdivision when the image is cut into maxSubdivisions bands of rows
+inline void BandRows(unsigned height, int maxSubdivisions, int thisSubdivision, unsigned& startRow, unsigned& endRow)
+{
+	double YFraction = (double)height / maxSubdivisions;
+	startRow = (unsigned)(YFraction * thisSubdivision);
+	endRow = (unsigned)(YFraction * (thisSubdivision + 1));
+}
+
+//[comment]
+// 1 shades the camera hits of renderRegion with the material-specialised kernels (shadeByClass)
+// instead of traceFromHit. They don't cull weak rays; TraceComparison times the two.
+//[/comment]
+#define SPECIALISED_SHADING 0
+
+//[comment]
+// Renders the pixels [x0, x1) x [y0, y1) of the image into pImage (the whole image).
+// optimization: primary rays are traced as PACKET_DIM x PACKET_DIM packets, every sphere is loaded once per packet
+// and tested against all of its rays. The secondary bounces are incoherent, so they fall back to single rays.
+// stack is the ray stack of the iterative trace, owned by the calling thread.
+//[/comment]
+void renderRegion(const CompiledScene& scene, Vec3f* pImage, unsigned x0, unsigned y0, unsigned x1, unsigned y1, unsigned const width, unsigned const height, PendingRay* stack)
+{
+	Camera camera(width, height);
+	Vec3f zero = Vec3f(0);
+	for (unsigned by = y0; by < y1; by += PACKET_DIM) {
+		for (unsigned bx = x0; bx < x1; bx += PACKET_DIM) {
+			RayPacket packet(zero);
+			Vec3f* packetPixels[PACKET_SIZE];
+			for (unsigned y = by; y < by + PACKET_DIM && y < y1; ++y) {
+				for (unsigned x = bx; x < bx + PACKET_DIM && x < x1; ++x) {
+					packetPixels[packet.count] = pImage + y * width + x;
+					packet.Add(camera.Direction(x, y));
 				}
-				surfaceColor += sphere->surfaceColor * transmission *
-					std::max(float(0), nhit.dot(lightDirection)) * temp.emissionColor;
+			}
+			packet.Pad();
+
+			alignas(32) float tnear[PACKET_SIZE];
+			alignas(32) int hitIndex[PACKET_SIZE];
+			for (int i = 0; i < PACKET_SIZE; ++i) tnear[i] = INFINITY, hitIndex[i] = -1;
+			scene.IntersectPacket(packet, tnear, hitIndex);
+
+			for (int i = 0; i < packet.count; ++i) {
+				if (hitIndex[i] < 0) *packetPixels[i] = Vec3f(2);
+				else if (SPECIALISED_SHADING) *packetPixels[i] = shadeByClass<0>(zero, packet.GetDirection(i), scene, hitIndex[i], tnear[i]);
+				else *packetPixels[i] = traceFromHit(zero, packet.GetDirection(i), scene, hitIndex[i], tnear[i], stack);
 			}
 		}
 	}
+}
+
+void threadedRender(const CompiledScene& scene, Vec3f* pImage, const int maxSubdivisions, const int thisSubdivision, unsigned const width, unsigned const height)
+{
+	unsigned startIndex, endIndex;
+	BandRows(height, maxSubdivisions, thisSubdivision, startIndex, endIndex);
+
+	//the threads don't fight over the image, every one writes its own band, so no mutex is needed
+	PendingRay stack[TRACE_STACK_SIZE]; //ray stack of the iterative trace, shared by every pixel of the band
+	renderRegion(scene, pImage, 0, startIndex, width, endIndex, width, height, stack);
+	FlushRayCounters();
 
-	return surfaceColor + sphere->emissionColor;
 }
 
+//[comment]
+// Work-stealing version of threadedRender: instead of a fixed band, worker renders whatever tiles
+// the scheduler hands it until the frame is done.
+//[/comment]
+void tileRender(const CompiledScene& scene, TileScheduler* tiles, Vec3f* pImage, const int worker, unsigned const width, unsigned const height)
+{
+	PendingRay stack[TRACE_STACK_SIZE];
+	tiles->Run(worker, [&](const Tile& tile) {
+		renderRegion(scene, pImage, tile.x0, tile.y0, tile.x1, tile.y1, width, height, stack);
+	});
+	FlushRayCounters();
+}
 
 //[comment]
 // Main rendering function. We compute a camera ray for each pixel of the image
 // trace it and return a color. If the ray hits a sphere, we return the color of the
 // sphere at the intersection point, else we return the background color.
 //[/comment]
-void render(const std::vector<Sphere>& spheres, int iteration)
+//tiles has to have one worker per thread of the pool. Passing the same scheduler for every frame of
+//an animation lets it order the tiles by their cost in the previous frame.
+//With fibers the image is cut into FIBER_JOB_SIZE squares instead, every one a fiber job that yields
+//after each row, and tiles isn't used.
+void render(const CompiledScene& scene, int iteration, ThreadPool& pool, TileScheduler& tiles, FiberScheduler* fibers = nullptr)
 {
 
 
@@ -279,24 +647,37 @@ void render(const std::vector<Sphere>& spheres, int iteration)
 
 	// Recommended Production Resolution
 	unsigned width = 1920, height = 1080;
-	Vec3f* image = new Vec3f[width * height], * pixel = image; //array of colors
-	float invWidth = 2 / float(width), invHeight = 2 / float(height); //optimization: rather than multiplying by 2 on every iteration, just do it here once.
-	float fov = 30, aspectratio = width / float(height);
-	float angle = tan(M_PI * 0.5 * fov / 180.);
-	float angleAndAspect = angle * aspectratio;
+	Vec3f* image = (Vec3f*)AllocatePages(width * height * sizeof(Vec3f), FRAMEBUFFER_PAGE_POLICY); //array of colors
 
 
 	// Trace rays
-	Vec3f zero = Vec3f(0);
-	for (unsigned y = 0; y < height; ++y) {
-		for (unsigned x = 0; x < width; ++x, ++pixel) {
-			//optimization: removing "+0.5" from xx and yy didnt make a difference to the output image
-			float xx = (x * invWidth - 1) * angleAndAspect;
-			float yy = (1 - y * invHeight) * angle;
-			Vec3f raydir(xx, yy, -1);
-			raydir.normalize();
-			*pixel = trace(zero, raydir, spheres, 0);
+	//the image is split into tiles that the workers of the pool take and steal from each other
+	if (fibers) {
+		for (unsigned y0 = 0; y0 < height; y0 += FIBER_JOB_SIZE) {
+			for (unsigned x0 = 0; x0 < width; x0 += FIBER_JOB_SIZE) {
+				fibers->Add([&, x0, y0]() {
+					PendingRay stack[TRACE_STACK_SIZE]; //on the fiber's stack, a fiber never changes thread
+					unsigned x1 = std::min(x0 + FIBER_JOB_SIZE, width);
+					for (unsigned y = y0; y < std::min(y0 + FIBER_JOB_SIZE, height); ++y) {
+						renderRegion(scene, image, x0, y, x1, y + 1, width, height, stack);
+						FiberScheduler::YieldFiber();
+					}
+					FlushRayCounters();
+				});
+			}
 		}
+		unsigned long long switches = fibers->Switches();
+		fibers->Run(pool);
+		std::cout << "Fibers: " << fibers->JobsRun() << " jobs so far, " << fibers->Switches() - switches << " switches this frame." << std::endl;
+	}
+	else {
+		tiles.Reset(width, height);
+		for (int worker = 0; worker < tiles.WorkerCount(); ++worker) {
+			pool.Submit(std::bind(tileRender, std::cref(scene), &tiles, image, worker, width, height));
+		}
+		pool.Wait();
+		tiles.EndFrame();
+		tiles.Report(std::cout);
 	}
 
 
@@ -314,44 +695,550 @@ void render(const std::vector<Sphere>& spheres, int iteration)
 			(unsigned char)(std::min(float(1), image[i].z) * 255);
 	}
 	ofs.close();
-	delete[] image;
+	FreePages(image);
 }
-////////////////////////////////////////////////////////////////////////// my edit
-void threadedRender(const std::vector<Sphere*>& spheres, Vec3f* pImage, std::mutex* data, const int maxSubdivisions, const int thisSubdivision, unsigned const width, unsigned const height)
+
+//[comment]
+// What changed in the scene since the frame the dependency buffer was recorded for. all forces a
+// full render, otherwise slots lists the BVH slots of the spheres that moved or changed material
+// and mask has their bits set. A sphere that is or was a light has to set all.
+//[/comment]
+struct SceneChanges
 {
+	bool all;
+	std::vector<int> slots;
+	uint64_t mask;
+};
 
-	Vec3f* pixel = pImage; //copy of pointer to be used for iteration
-	float invWidth = 2 / float(width), invHeight = 2 / float(height); //optimization: rather than multiplying by 2 on every iteration, just do it here once.
-	float fov = 30, aspectratio = width / float(height);
-	float angle = tan(M_PI * 0.5 * fov / 180.);
-	float angleAndAspect = angle * aspectratio;
+//extra radius and distance the dependency tests allow for the bias and rounding of the renderer
+#define DEPENDENCY_MARGIN 1e-3f
 
-	//find subdivision location
-	double YFraction = (double)height / maxSubdivisions;
-	int startIndex = YFraction * thisSubdivision;
-	int endIndex = YFraction * (thisSubdivision + 1);
+//conservative version of Sphere::occluded: true if a ray starting anywhere within DEPENDENCY_MARGIN
+//of rayorig could enter the sphere before tmax
+bool MayHit(const Sphere& sphere, const Vec3f& rayorig, const Vec3f& raydir, float tmax)
+{
+	float radius = sphere.radius + DEPENDENCY_MARGIN;
+	Vec3f l = sphere.center - rayorig;
+	float tca = l.dot(raydir);
+	if (tca < -radius) return false;
+	float d2 = l.dot(l) - tca * tca;
+	if (d2 > radius * radius) return false;
+	return tca - sqrt(radius * radius - d2) < tmax + DEPENDENCY_MARGIN;
+}
+
+//[comment]
+// True if the changes can affect the pixel through its recorded dependencies: one of its rays hit,
+// was blocked by or was lit by a changed sphere, or one of its secondary or shadow rays could hit
+// a changed sphere now. rays is the ray list of the pixel's row.
+//[/comment]
+bool DependenciesChanged(const CompiledScene& scene, const PixelDependencies& dependencies, const DependencyRay* rays, const SceneChanges& changes)
+{
+	if (dependencies.spheres & changes.mask) return true;
+	if (dependencies.rayCount == 0) return false;
+	for (int slot : changes.slots) {
+		const Sphere* sphere = scene.GetBVH().GetSphere(slot);
+		for (unsigned i = dependencies.firstRay; i < dependencies.firstRay + dependencies.rayCount; ++i) {
+			if (MayHit(*sphere, rays[i].origin, rays[i].direction, rays[i].tmax)) return true;
+		}
+	}
+	return false;
+}
+
+//true if the camera ray with this direction could hit one of the changed spheres now
+bool CameraRayChanged(const CompiledScene& scene, const SceneChanges& changes, const Vec3f& raydir)
+{
+	for (int slot : changes.slots) {
+		if (MayHit(*scene.GetBVH().GetSphere(slot), Vec3f(0), raydir, INFINITY)) return true;
+	}
+	return false;
+}
+
+//[comment]
+// Conservative pixel rectangle [x0, x1] x [y0, y1] the camera rays that can hit a changed sphere
+// fall into, found by projecting the corners of the bounding box of each sphere. A sphere that
+// reaches behind the camera covers the whole image. The rectangle is empty (x0 > x1) if nothing
+// changed.
+//[/comment]
+void ChangedScreenBounds(const CompiledScene& scene, const SceneChanges& changes, const Camera& camera, unsigned width, unsigned height, int& x0, int& y0, int& x1, int& y1)
+{
+	x0 = (int)width, y0 = (int)height, x1 = -1, y1 = -1;
+	for (int slot : changes.slots) {
+		const Sphere* sphere = scene.GetBVH().GetSphere(slot);
+		float radius = sphere->radius + DEPENDENCY_MARGIN;
+		if (sphere->center.z + radius >= -DEPENDENCY_MARGIN) {
+			x0 = 0, y0 = 0, x1 = (int)width - 1, y1 = (int)height - 1;
+			return;
+		}
+		for (int corner = 0; corner < 8; ++corner) {
+			Vec3f p = sphere->center + Vec3f(corner & 1 ? radius : -radius, corner & 2 ? radius : -radius, corner & 4 ? radius : -radius);
+			//inverse of the camera ray setup of the render functions, one pixel of slack on every side
+			float px = (p.x / -p.z / camera.angleAndAspect + 1) * width * 0.5f;
+			float py = (1 - p.y / -p.z / camera.angle) * height * 0.5f;
+			x0 = std::min(x0, (int)floor(px) - 1), x1 = std::max(x1, (int)ceil(px) + 1);
+			y0 = std::min(y0, (int)floor(py) - 1), y1 = std::max(y1, (int)ceil(py) + 1);
+		}
+	}
+	x0 = std::max(x0, 0), y0 = std::max(y0, 0);
+	x1 = std::min(x1, (int)width - 1), y1 = std::min(y1, (int)height - 1);
+}
 
-	//find the start position of the pointer
-	pixel = (Vec3f*)((char*)pixel + (startIndex * width * sizeof(Vec3f)));
+std::atomic<unsigned long long> totalRetracedPixels(0);
 
+//[comment]
+// Incremental version of threadedRender. Only the pixels the scene changes can affect are traced
+// again, everything else keeps its colour from the previous frame in pImage, so the cost of a
+// frame follows the screen area of the change instead of the resolution. The traced pixels
+// record their new dependencies. The result is the same image a full render gives.
+//[/comment]
+void incrementalRender(const CompiledScene& scene, DependencyBuffer* dependencies, const SceneChanges* changes, Vec3f* pImage, const int maxSubdivisions, const int thisSubdivision, unsigned const width, unsigned const height)
+{
+	Camera camera(width, height);
+	unsigned startIndex, endIndex;
+	BandRows(height, maxSubdivisions, thisSubdivision, startIndex, endIndex);
 
-	// Trace rays
+	int x0, y0, x1, y1;
+	ChangedScreenBounds(scene, *changes, camera, width, height, x0, y0, x1, y1);
+
+	//the image is handled PACKET_DIM rows at a time: find the pixels to trace, carry the rays of the
+	//other pixels over into the new ray lists of their rows, then trace the changed pixels as packets
 	Vec3f zero = Vec3f(0);
+	PendingRay stack[TRACE_STACK_SIZE];
+	std::vector<char> retrace(width * PACKET_DIM);
+	bool rowChanged[PACKET_DIM];
+	unsigned long long retracedPixels = 0;
+	for (unsigned by = startIndex; by < endIndex; by += PACKET_DIM) {
+		unsigned rowEnd = std::min(by + PACKET_DIM, endIndex);
+		for (unsigned y = by; y < rowEnd; ++y) {
+			const DependencyRay* oldRays = dependencies->rowRays[y].data();
+			const PixelDependencies* rowDependencies = dependencies->pixels.data() + y * width;
+			char* rowRetrace = &retrace[(y - by) * width];
+			bool rowInBounds = (int)y >= y0 && (int)y <= y1;
+			rowChanged[y - by] = false;
+			//optimization: a row the change can't reach through its dependencies or its camera rays is not looked at
+			if (!changes->all && !rowInBounds && !(dependencies->rowSpheres[y] & changes->mask) && dependencies->rowRays[y].empty()) {
+				memset(rowRetrace, 0, width);
+				continue;
+			}
+			for (unsigned x = 0; x < width; ++x) {
+				bool changed = changes->all || DependenciesChanged(scene, rowDependencies[x], oldRays, *changes);
+				if (!changed && rowInBounds && (int)x >= x0 && (int)x <= x1) {
+					Vec3f raydir = camera.Direction(x, y);
+					changed = CameraRayChanged(scene, *changes, raydir);
+				}
+				rowRetrace[x] = changed;
+				rowChanged[y - by] |= changed;
+			}
+			if (!rowChanged[y - by]) continue;
+			std::vector<DependencyRay>& newRays = dependencies->spareRowRays[y];
+			newRays.clear();
+			for (unsigned x = 0; x < width; ++x) {
+				if (rowRetrace[x]) continue;
+				PixelDependencies& pixelDependencies = dependencies->pixels[y * width + x];
+				unsigned firstRay = (unsigned)newRays.size();
+				newRays.insert(newRays.end(), oldRays + pixelDependencies.firstRay, oldRays + pixelDependencies.firstRay + pixelDependencies.rayCount);
+				pixelDependencies.firstRay = firstRay;
+			}
+		}
+
+		for (unsigned bx = 0; bx < width; bx += PACKET_DIM) {
+			RayPacket packet(zero);
+			unsigned packetPixels[PACKET_SIZE];
+			for (unsigned y = by; y < rowEnd; ++y) {
+				for (unsigned x = bx; x < bx + PACKET_DIM && x < width; ++x) {
+					if (!retrace[(y - by) * width + x]) continue;
+					Vec3f raydir = camera.Direction(x, y);
+					packetPixels[packet.count] = y * width + x;
+					packet.Add(raydir);
+				}
+			}
+			if (packet.count == 0) continue;
+			packet.Pad();
+
+			alignas(32) float tnear[PACKET_SIZE];
+			alignas(32) int hitIndex[PACKET_SIZE];
+			for (int i = 0; i < PACKET_SIZE; ++i) tnear[i] = INFINITY, hitIndex[i] = -1;
+			scene.IntersectPacket(packet, tnear, hitIndex);
+
+			for (int i = 0; i < packet.count; ++i) {
+				unsigned index = packetPixels[i];
+				DependencyRecorder recorder;
+				recorder.spheres = 0;
+				recorder.rays = &dependencies->spareRowRays[index / width];
+				unsigned firstRay = (unsigned)recorder.rays->size();
+				if (hitIndex[i] < 0) pImage[index] = Vec3f(2);
+				else pImage[index] = traceFromHit(zero, packet.GetDirection(i), scene, hitIndex[i], tnear[i], stack, &recorder);
+				PixelDependencies& pixelDependencies = dependencies->pixels[index];
+				pixelDependencies.spheres = recorder.spheres;
+				pixelDependencies.firstRay = firstRay;
+				pixelDependencies.rayCount = (unsigned)recorder.rays->size() - firstRay;
+			}
+			retracedPixels += packet.count;
+		}
+
+		for (unsigned y = by; y < rowEnd; ++y) {
+			if (!rowChanged[y - by]) continue;
+			dependencies->rowRays[y].swap(dependencies->spareRowRays[y]);
+			uint64_t spheres = 0;
+			for (unsigned x = 0; x < width; ++x) spheres |= dependencies->pixels[y * width + x].spheres;
+			dependencies->rowSpheres[y] = spheres;
+		}
+	}
+	FlushRayCounters();
+	totalRetracedPixels += retracedPixels;
+}
+
+//[comment]
+// Traces a camera ray against the static spheres alone and appends the closest static hit of every
+// ray of its tree to hits. These are the rays a frame can take from the cache: as long as every
+// hit above a ray is static, the ray is the same in the full scene.
+//[/comment]
+void recordStaticHits(PendingRay& ray, PendingRay* stack, const CompiledScene& scene, std::vector<StaticHit>& hits)
+{
+	int stackSize = 0;
+	Vec3f color = 0;
+	//the rays are traced again by traceCached, only that trace counts them
+	RayCounters counters = threadRayCounters;
+	while (true) {
+		StaticHit hit;
+		hit.node = ray.node;
+		hit.slot = -1;
+		hit.tnear = INFINITY;
+		bool follow = false;
+		if (scene.IntersectStatic(ray.origin, ray.direction, hit.tnear, hit.slot)) {
+			follow = shadeHit(ray, scene, scene.GetStaticHitSlot(hit.slot), hit.tnear, color, stack, stackSize);
+		}
+		hits.push_back(hit);
+		if (!follow) {
+			if (stackSize == 0) break;
+			ray = stack[--stackSize];
+		}
+	}
+	threadRayCounters = counters;
+}
+
+//[comment]
+// traceStack for a pixel whose static hits are cached. A ray the cache knows (node != 0) starts
+// from its cached static hit and is only intersected with the dynamic spheres. A ray that hits a
+// dynamic sphere, or that the cache doesn't know, gets node 0, so it and everything below it is
+// intersected with the whole scene.
+//[/comment]
+Vec3f traceCached(PendingRay& ray, PendingRay* stack, const CompiledScene& scene, const StaticHit* hits, unsigned hitCount)
+{
+	int stackSize = 0;
+	Vec3f color = 0;
+	while (true) {
+		float tnear = INFINITY;
+		int hitIndex = -1;
+		const StaticHit* cached = ray.node ? FindStaticHit(hits, hitCount, ray.node) : nullptr;
+		if (cached) {
+			if (cached->slot >= 0) {
+				tnear = cached->tnear;
+				hitIndex = scene.GetStaticHitSlot(cached->slot);
+			}
+			if (scene.IntersectDynamic(ray.origin, ray.direction, tnear, hitIndex)) ray.node = 0;
+		}
+		else {
+			scene.Intersect(ray.origin, ray.direction, tnear, hitIndex);
+			ray.node = 0;
+		}
+		bool follow = false;
+		if (hitIndex >= 0) {
+			follow = shadeHit(ray, scene, hitIndex, tnear, color, stack, stackSize);
+		}
+		else {
+			color += ray.weight * Vec3f(2);
+		}
+		if (!follow) {
+			if (stackSize == 0) return color;
+			ray = stack[--stackSize];
+		}
+	}
+}
+
+//[comment]
+// Full render that takes the closest static hit of every ray it can from the static hit cache, so
+// the intersection work of a frame follows the number of dynamic spheres rather than the scene
+// size. The first frame after the static spheres changed records the cache first, which costs
+// about one extra render.
+//[/comment]
+void staticCacheRender(const CompiledScene& scene, StaticHitCache* cache, Vec3f* pImage, const int maxSubdivisions, const int thisSubdivision, unsigned const width, unsigned const height)
+{
+	Camera camera(width, height);
+	unsigned startIndex, endIndex;
+	BandRows(height, maxSubdivisions, thisSubdivision, startIndex, endIndex);
+
+	bool record = !cache->IsValid(scene.GetStaticBuildCount());
+	PendingRay stack[TRACE_STACK_SIZE];
 	for (unsigned y = startIndex; y < endIndex; ++y) {
-		for (unsigned x = 0; x < width; ++x, ++pixel) {
-			//optimization: removing "+0.5" from xx and yy didnt make a difference to the output image
-			float xx = (x * invWidth - 1) * angleAndAspect;
-			float yy = (1 - y * invHeight) * angle;
-			Vec3f raydir(xx, yy, -1);
-			raydir.normalize();
-			Vec3f temp = trace(zero, raydir, spheres, 0);
-			//the threads don't fight over this resource, the mutex is not actually needed!
-			//(*data).lock();
-			*pixel = temp;
-			//(*data).unlock();
+		std::vector<StaticHit>& hits = cache->rowHits[y];
+		if (record) hits.clear();
+		for (unsigned x = 0; x < width; ++x) {
+			Vec3f raydir = camera.Direction(x, y);
+			PendingRay ray;
+			ray.origin = Vec3f(0);
+			ray.direction = raydir;
+			ray.weight = Vec3f(1);
+			ray.depth = 0;
+			ray.node = 1;
+			StaticHitRange& range = cache->pixels[y * width + x];
+			if (record) {
+				PendingRay staticRay = ray;
+				range.first = (unsigned)hits.size();
+				recordStaticHits(staticRay, stack, scene, hits);
+				range.count = (unsigned)hits.size() - range.first;
+			}
+			pImage[y * width + x] = traceCached(ray, stack, scene, hits.data() + range.first, range.count);
+		}
+	}
+	FlushRayCounters();
+}
+
+//[comment]
+// Full render for frames that only changed materials. If the geometry is the same as in the frame
+// the G-buffer was recorded for, every pixel starts shading from its G-buffer texel and no camera
+// ray is intersected. Otherwise the camera rays are intersected as usual and their hits recorded.
+//[/comment]
+void gbufferRender(const CompiledScene& scene, GBuffer* gbuffer, Vec3f* pImage, const int maxSubdivisions, const int thisSubdivision, unsigned const width, unsigned const height)
+{
+	Camera camera(width, height);
+	unsigned startIndex, endIndex;
+	BandRows(height, maxSubdivisions, thisSubdivision, startIndex, endIndex);
+
+	bool record = !gbuffer->IsValid(scene.GetGeometryVersion());
+	PendingRay stack[TRACE_STACK_SIZE];
+	for (unsigned y = startIndex; y < endIndex; ++y) {
+		for (unsigned x = 0; x < width; ++x) {
+			Vec3f raydir = camera.Direction(x, y);
+			PendingRay ray;
+			ray.origin = Vec3f(0);
+			ray.direction = raydir;
+			ray.weight = Vec3f(1);
+			ray.depth = 0;
+			ray.node = 1;
+			GBufferTexel& texel = gbuffer->pixels[y * width + x];
+			if (record) {
+				texel.slot = -1;
+				texel.tnear = INFINITY;
+				if (scene.Intersect(ray.origin, ray.direction, texel.tnear, texel.slot)) {
+					texel.normal = ray.origin + ray.direction * texel.tnear - scene.GetCenter(texel.slot);
+					texel.normal.normalize();
+				}
+			}
+			Vec3f& pixel = pImage[y * width + x];
+			if (texel.slot < 0) {
+				pixel = Vec3f(2);
+				continue;
+			}
+			int stackSize = 0;
+			Vec3f color = 0;
+			Vec3f phit = ray.origin + ray.direction * texel.tnear;
+			if (shadeSurface(ray, scene, texel.slot, phit, texel.normal, color, stack, stackSize)) color = traceStack(ray, stack, stackSize, scene, color);
+			pixel = color;
+		}
+	}
+	FlushRayCounters();
+}
+
+//[comment]
+// Wavefront renderer. Instead of following the ray tree of one pixel at a time, a tile of
+// WAVEFRONT_TILE_ROWS image rows is pushed through the stages below: generate the camera rays,
+// find their closest hits, shade the hits, spawn the reflection/refraction rays into the next
+// queue and test the shadow rays. Each stage runs over the whole queue before the next one
+// starts, so every loop does one kind of work on tightly packed data, and the next queue is
+// processed the same way until no rays are left. Every stage works on a [first, last) range of
+// its queue, so a stage can also be split across threads on its own.
+// The tile keeps the queues small enough to stay in the cache (a few hundred KB each).
+//[/comment]
+#define WAVEFRONT_TILE_ROWS 8
+
+//camera rays for rows [startRow, endRow), ordered in PACKET_DIM x PACKET_DIM blocks so consecutive rays are coherent
+void GenerateStage(RayQueue& rays, unsigned startRow, unsigned endRow, unsigned width, unsigned height)
+{
+	Camera camera(width, height);
+	Vec3f zero = Vec3f(0), one = Vec3f(1);
+
+	rays.Reserve((endRow - startRow) * width);
+	rays.Clear();
+	for (unsigned by = startRow; by < endRow; by += PACKET_DIM) {
+		for (unsigned bx = 0; bx < width; bx += PACKET_DIM) {
+			for (unsigned y = by; y < by + PACKET_DIM && y < endRow; ++y) {
+				for (unsigned x = bx; x < bx + PACKET_DIM && x < width; ++x) {
+					rays.Push(zero, camera.Direction(x, y), one, y * width + x, 0);
+				}
+			}
+		}
+	}
+}
+
+//[comment]
+// Closest hit of every ray in [first, last). Camera rays share their origin and come in blocks,
+// so they are tested PACKET_SIZE at a time with the packet traversal. first has to be a multiple
+// of PACKET_SIZE for them.
+//[/comment]
+void ClosestHitStage(const CompiledScene& scene, RayQueue& rays, int first, int last, bool cameraRays)
+{
+	if (cameraRays) {
+		for (int i = first; i < last; i += PACKET_SIZE) {
+			RayPacket packet(rays.GetOrigin(i));
+			for (int j = i; j < last && j < i + PACKET_SIZE; ++j) packet.Add(rays.GetDirection(j));
+			packet.Pad();
+
+			alignas(32) float tnear[PACKET_SIZE];
+			alignas(32) int hitIndex[PACKET_SIZE];
+			for (int j = 0; j < PACKET_SIZE; ++j) tnear[j] = INFINITY, hitIndex[j] = -1;
+			scene.IntersectPacket(packet, tnear, hitIndex);
+			for (int j = 0; j < packet.count; ++j) {
+				rays.tnear[i + j] = tnear[j];
+				rays.hitIndex[i + j] = hitIndex[j];
+			}
 		}
+		return;
 	}
+	for (int i = first; i < last; ++i) {
+		float tnear = INFINITY;
+		int hitIndex = -1;
+		scene.Intersect(rays.GetOrigin(i), rays.GetDirection(i), tnear, hitIndex);
+		rays.tnear[i] = tnear;
+		rays.hitIndex[i] = hitIndex;
+	}
+}
+
+//[comment]
+// Adds the background colour of the misses and the emission of the hits to the image, stores
+// the hit point and normal for the spawn stage and queues a shadow ray towards every light seen
+// by a diffuse hit. Shadow rays whose light is behind the surface would add nothing and are
+// not queued. The shadow queue has to be empty.
+//[/comment]
+void ShadeStage(const CompiledScene& scene, RayQueue& rays, int first, int last, ShadowQueue& shadows, Vec3f* image)
+{
+	const std::vector<Light>& lights = scene.GetLights();
+	shadows.Reserve((last - first) * (int)lights.size());
 
+	float bias = 1e-4; // add some bias to the point from which we will be tracing
+	for (int i = first; i < last; ++i) {
+		Vec3f weight = rays.GetWeight(i);
+		if (rays.hitIndex[i] < 0) {
+			image[rays.pixel[i]] += weight * Vec3f(2);
+			continue;
+		}
+		const Material& material = scene.GetMaterial(rays.hitIndex[i]);
+		Vec3f raydir = rays.GetDirection(i);
+		Vec3f phit = rays.GetOrigin(i) + raydir * rays.tnear[i]; // point of intersection
+		Vec3f nhit = phit - scene.GetCenter(rays.hitIndex[i]); // normal at the intersection point
+		nhit.normalize(); // normalize normal direction
+		bool inside = false;
+		if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true;
+		image[rays.pixel[i]] += weight * material.emissionColor;
+
+		rays.pointX[i] = phit.x, rays.pointY[i] = phit.y, rays.pointZ[i] = phit.z;
+		rays.normalX[i] = nhit.x, rays.normalY[i] = nhit.y, rays.normalZ[i] = nhit.z;
+		rays.inside[i] = inside;
+
+		bool transparent = material.transparency > 0;
+		bool reflective = material.reflection > 0;
+		if ((transparent || reflective) && rays.depth[i] < MAX_RAY_DEPTH) continue;
+
+		// it's a diffuse object, no need to raytrace any further
+		for (const Light& light : lights) {
+			Vec3f lightDirection = light.center - phit;
+			float lightDistance = lightDirection.length(); //spheres behind the light don't cast a shadow
+			lightDirection.normalize();
+			float facing = nhit.dot(lightDirection);
+			if (facing <= 0) continue;
+			shadows.Push(phit + nhit * bias, lightDirection, lightDistance, weight * material.surfaceColor * facing * light.emissionColor, light.slot, rays.pixel[i]);
+		}
+	}
+}
+
+//[comment]
+// Pushes the reflection and refraction rays of the reflective/transparent hits in [first, last)
+// into next, weighted like the recursive trace mixes them. Rays too weak to change the pixel are
+// dropped (see RAY_CONTRIBUTION_EPSILON). next has to be empty.
+//[/comment]
+void SpawnStage(const CompiledScene& scene, const RayQueue& rays, int first, int last, RayQueue& next)
+{
+	next.Reserve((last - first) * 2);
+	float bias = 1e-4;
+	for (int i = first; i < last; ++i) {
+		if (rays.hitIndex[i] < 0 || rays.depth[i] >= MAX_RAY_DEPTH) continue;
+		const Material& material = scene.GetMaterial(rays.hitIndex[i]);
+		bool transparent = material.transparency > 0;
+		bool reflective = material.reflection > 0;
+		if (!transparent && !reflective) continue;
+
+		Vec3f raydir = rays.GetDirection(i);
+		Vec3f phit = rays.GetPoint(i);
+		Vec3f nhit = rays.GetNormal(i);
+		float facingratio = -raydir.dot(nhit);
+		// change the mix value to tweak the effect
+		float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
+		// the result is a mix of reflection and refraction, tinted by the surface color
+		Vec3f surfaceWeight = rays.GetWeight(i) * material.surfaceColor;
+
+		if (reflective) {
+			Vec3f reflectionWeight = surfaceWeight * fresneleffect;
+			if (KeepRay(reflectionWeight, scene)) {
+				Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
+				refldir.normalize();
+				next.Push(phit + nhit * bias, refldir, reflectionWeight, rays.pixel[i], rays.depth[i] + 1);
+			}
+		}
+		if (transparent) {
+			Vec3f refractionWeight = surfaceWeight * ((1 - fresneleffect) * material.transparency);
+			if (KeepRay(refractionWeight, scene)) {
+				float ior = 1.1, eta = (rays.inside[i]) ? ior : 1 / ior; // are we inside or outside the surface?
+				float cosi = -nhit.dot(raydir);
+				float k = 1 - eta * eta * (1 - cosi * cosi);
+				Vec3f refrdir = raydir * eta + nhit * (eta * cosi - sqrt(k));
+				refrdir.normalize();
+				next.Push(phit - nhit * bias, refrdir, refractionWeight, rays.pixel[i], rays.depth[i] + 1);
+			}
+		}
+	}
+}
+
+//adds the light of every shadow ray in [first, last) that reaches its light
+void ShadowStage(const CompiledScene& scene, const ShadowQueue& shadows, int first, int last, Vec3f* image)
+{
+	for (int i = first; i < last; ++i) {
+		if (!scene.Occluded(shadows.GetOrigin(i), shadows.GetDirection(i), shadows.tmax[i], shadows.light[i])) {
+			image[shadows.pixel[i]] += shadows.GetContribution(i);
+		}
+	}
+}
+
+//[comment]
+// Band of the image rendered with the wavefront stages, same arguments as threadedRender so the
+// two can be swapped in SmoothScaling. The queues are allocated once per band and reused by
+// every tile and bounce.
+//[/comment]
+void wavefrontRender(const CompiledScene& scene, Vec3f* pImage, const int maxSubdivisions, const int thisSubdivision, unsigned const width, unsigned const height)
+{
+	unsigned startIndex, endIndex;
+	BandRows(height, maxSubdivisions, thisSubdivision, startIndex, endIndex);
+
+	//the stages accumulate into the image, so the band starts out black
+	for (unsigned i = startIndex * width; i < endIndex * width; ++i) pImage[i] = Vec3f(0);
+
+	RayQueue queues[2];
+	ShadowQueue shadows;
+	for (unsigned tileRow = startIndex; tileRow < endIndex; tileRow += WAVEFRONT_TILE_ROWS) {
+		unsigned tileEnd = std::min(tileRow + WAVEFRONT_TILE_ROWS, endIndex);
+		int current = 0;
+		GenerateStage(queues[current], tileRow, tileEnd, width, height);
+		for (bool cameraRays = true; queues[current].count > 0; cameraRays = false) {
+			RayQueue& rays = queues[current];
+			RayQueue& next = queues[1 - current];
+			next.Clear();
+			shadows.Clear();
+			ClosestHitStage(scene, rays, 0, rays.count, cameraRays);
+			ShadeStage(scene, rays, 0, rays.count, shadows, pImage);
+			SpawnStage(scene, rays, 0, rays.count, next);
+			if (scene.HasLights()) ShadowStage(scene, shadows, 0, shadows.count, pImage);
+			current = 1 - current;
+		}
+	}
+	FlushRayCounters();
 }
 void FileCreation(unsigned const width, unsigned const height, Vec3f* image, int iteration)
 {
@@ -371,7 +1258,49 @@ void FileCreation(unsigned const width, unsigned const height, Vec3f* image, int
 	ofs.close();
 }
 
-void BasicRender()
+//[comment]
+// FileCreation split into its stages for the frame pipeline: quantise rows of the image to 8 bit
+// RGB, encode the PPM file in memory and write it out. The bytes are the same as FileCreation's.
+//[/comment]
+void QuantiseRows(const Vec3f* image, unsigned char* bytes, unsigned const width, unsigned firstRow, unsigned lastRow)
+{
+	for (unsigned i = firstRow * width; i < lastRow * width; ++i) {
+		bytes[i * 3] = (unsigned char)(std::min(float(1), image[i].x) * 255);
+		bytes[i * 3 + 1] = (unsigned char)(std::min(float(1), image[i].y) * 255);
+		bytes[i * 3 + 2] = (unsigned char)(std::min(float(1), image[i].z) * 255);
+	}
+}
+void EncodePPM(const unsigned char* bytes, unsigned const width, unsigned const height, std::vector<char>& file)
+{
+	std::stringstream header;
+	header << "P6\n" << width << " " << height << "\n255\n";
+	std::string headerString = header.str();
+	file.assign(headerString.begin(), headerString.end());
+	file.insert(file.end(), bytes, bytes + width * height * 3);
+}
+void WriteFile(const std::vector<char>& file, int iteration)
+{
+	std::stringstream ss;
+	ss << "./spheres" << iteration << ".ppm";
+	std::ofstream ofs(ss.str().c_str(), std::ios::out | std::ios::binary);
+	ofs.write(file.data(), file.size());
+	ofs.close();
+}
+
+//pointers to spheres kept by value, as CompiledScene::Compile takes them. The spheres must stay where they are while the scene is used
+std::vector<Sphere*> SpherePointers(std::vector<Sphere>& spheres)
+{
+	std::vector<Sphere*> objects;
+	for (Sphere& sphere : spheres) objects.push_back(&sphere);
+	return objects;
+}
+
+//[comment]
+// 1 renders BasicRender's frame as fiber jobs (see render) instead of work-stealing tiles.
+//[/comment]
+#define RENDER_WITH_FIBERS 0
+
+void BasicRender(ThreadPool& pool)
 {
 	std::vector<Sphere> spheres;
 	// Vector structure for Sphere (position, radius, surface color, reflectivity, transparency, emission color)
@@ -384,7 +1313,12 @@ void BasicRender()
 	auto start = std::chrono::system_clock::now();
 
 	// This creates a file, titled 1.ppm in the current working directory
-	render(spheres, 1);
+	CompiledScene scene;
+	scene.Compile(SpherePointers(spheres));
+	TileScheduler tiles(pool.Size());
+	std::unique_ptr<FiberScheduler> fibers;
+	if (RENDER_WITH_FIBERS) fibers.reset(new FiberScheduler(pool.Size(), FIBERS_PER_WORKER));
+	render(scene, 1, pool, tiles, fibers.get());
 	auto finish = std::chrono::system_clock::now();
 	double elapsedSeconds = std::chrono::duration_cast<std::chrono::duration<double>>(finish - start).count();
 
@@ -394,9 +1328,11 @@ void BasicRender()
 
 }
 
-void SimpleShrinking()
+void SimpleShrinking(ThreadPool& pool)
 {
 	std::vector<Sphere> spheres;
+	CompiledScene scene;
+	TileScheduler tiles(pool.Size()); //kept across the frames, see render
 	// Vector structure for Sphere (position, radius, surface color, reflectivity, transparency, emission color)
 
 	for (int i = 0; i < 4; i++)
@@ -431,13 +1367,56 @@ void SimpleShrinking()
 			spheres.push_back(Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0));
 		}
 
-		render(spheres, i);
+		scene.Compile(SpherePointers(spheres));
+		render(scene, i, pool, tiles);
 		// Dont forget to clear the Vector holding the spheres.
 		spheres.clear();
 	}
 }
 
-void SmoothScaling()
+//[comment]
+// Frames whose quantised and encoded output can be in flight at the same time in SmoothScaling,
+// so frame N can still be encoded and written while frame N + 1 is traced.
+//[/comment]
+#define PIPELINE_FRAMES 2
+
+//[comment]
+// LinearAllocator flags of the memory SmoothScaling keeps its framebuffer and output buffers in,
+// e.g. LINEAR_ALLOCATOR_HUGE_PAGES | LINEAR_ALLOCATOR_LOCKED. Follows the framebuffer page policy.
+// SmoothScaling drops LINEAR_ALLOCATOR_HUGE_PAGES when its workers sit on more than one NUMA node:
+// a 2 MiB page holds about 90 rows of a 1080p image, more than one band, so the first touch of a
+// band can't put the band's pages on its worker's node.
+//[/comment]
+#define FRAME_MEMORY_FLAGS (FRAMEBUFFER_PAGE_POLICY == PagePolicy::HugePages ? LINEAR_ALLOCATOR_HUGE_PAGES : 0)
+
+//[comment]
+// What every render task of a SmoothScaling frame runs: its band with threadedRender, the tiles it
+// steals with tileRender, its band with wavefrontRender, staticCacheRender or incrementalRender.
+//[/comment]
+enum class BandRenderer
+{
+	Threaded,
+	Tiles,
+	Wavefront,
+	StaticCache,
+	Incremental
+};
+#define SMOOTH_SCALING_RENDERER BandRenderer::Incremental
+
+//[comment]
+// Every frame is a set of tasks in one task graph: update (the dynamic sphere), refit (compile the
+// scene), render (one task per band), quantise (per band), encode and write. The edges only
+// serialise what really shares data: a frame is updated once the previous one has been traced,
+// its bands are traced once the previous frame's image has been quantised, and the output buffers
+// are reused every PIPELINE_FRAMES frames. Everything else, like the encoding and file write of a
+// frame and the tracing of the next, runs side by side on the pool.
+// Band i is always traced and quantised by worker i, which is also the worker that touched the
+// band's rows of the image first. With pinned workers (PIN_RENDER_WORKERS) the OS puts those pages
+// on the worker's NUMA node, so no band writes memory on the other socket (the frame memory is
+// mapped with small pages then, see FRAME_MEMORY_FLAGS). The time spent tracing
+// is summed per node and printed at the end.
+//[/comment]
+void SmoothScaling(ThreadPool& pool)
 {
 	//pool of 4 spheres initialized - allocates memory
 	MemoryPool<Sphere>* spherePool = new MemoryPool<Sphere>(4);
@@ -447,70 +1426,326 @@ void SmoothScaling()
 	Sphere* sphere1 = new (spherePool) Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0, 0.0);
 	Sphere* sphere2 = new (spherePool) Sphere(Vec3f(5.0, -1, -15), 2, Vec3f(0.90, 0.76, 0.46), 1, 0.0);
 	Sphere* sphere3 = new (spherePool) Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0);
+	//these three never change, only the fourth sphere is dynamic
+	for (int slot : spherePool->GetLiveSlots()) spherePool->SetStatic(slot, true);
 
 	// Recommended Testing Resolution
 	//unsigned const width = 640, height = 480;
 
 	// Recommended Production Resolution
 	unsigned width = 1920, height = 1080;
-	int concurrency = 16;
-	std::vector<std::thread*> threadList;
-	//create the array of pixels and a mutex for it.
-	std::mutex data;
-	Vec3f* image = new Vec3f[width * height];
-	
-	//initialize the thread list
+	int concurrency = pool.Size(); //one band per worker
+	//the framebuffer and the quantised output of the frames in flight are mapped in one block for the whole run
+	LinearAllocator frameMemory;
+	int frameMemoryFlags = FRAME_MEMORY_FLAGS;
+	if (pool.NodeCount() > 1) frameMemoryFlags &= ~LINEAR_ALLOCATOR_HUGE_PAGES; //NUMA placement beats fewer TLB misses
+	size_t frameBytes = width * height * (sizeof(Vec3f) + 3 * PIPELINE_FRAMES) + 64 * (1 + PIPELINE_FRAMES);
+	//the flags are only a preference, normal pages are mapped if huge or locked pages can't be. Without any there is nothing to render to
+	if (!frameMemory.Initialize(frameBytes, frameMemoryFlags) && !frameMemory.Initialize(frameBytes)) {
+		std::cout << "Could not map " << frameBytes / 1024 << " KiB of frame memory, nothing was rendered." << std::endl;
+		delete spherePool;
+		return;
+	}
+	//optimization: mapped without touching it, every band is zeroed by the worker that renders it (first touch placement)
+	Vec3f* image = frameMemory.AllocateArray<Vec3f>(width * height);
 	for (int i = 0; i < concurrency; i++) {
-		std::thread* t = new std::thread();
-		threadList.push_back(t);
+		pool.SubmitTo(i, [=]() {
+			unsigned startIndex, endIndex;
+			BandRows(height, concurrency, i, startIndex, endIndex);
+			std::fill(image + startIndex * width, image + endIndex * width, Vec3f(0));
+		});
 	}
-
-	for (float r = 0; r <= 100; r++)
+	pool.Wait();
+	NodeCounters nodeCounters;
+	
+	//flat render scene (BVH, material table, lights), compiled once per frame before the threads start.
+	//Only the dynamic sphere changes between frames, so its BVH is refitted instead of rebuilt.
+	CompiledScene scene;
+	//what every pixel depended on in the last frame, so only the pixels the dynamic sphere can affect are traced again
+	DependencyBuffer dependencies;
+	SceneChanges changes;
+	//closest static hit of every ray, for the static cache renderer
+	StaticHitCache staticHits;
+	//only the buffer of the selected renderer gets its pixels, the other stays empty
+	switch (SMOOTH_SCALING_RENDERER) {
+	case BandRenderer::StaticCache: staticHits.Resize(width, height); break;
+	case BandRenderer::Incremental: dependencies.Resize(width, height); break;
+	default: break;
+	}
+	//tiles for the work-stealing renderer
+	TileScheduler tiles(concurrency);
+
+	const int frameCount = 101;
+	PoolHandle dynamicSphere;
+	int dynamicIndex = -1, buildCount = 0;
+	std::vector<unsigned long long> retracedPixels(frameCount);
+	unsigned char* quantised[PIPELINE_FRAMES];
+	std::vector<char> encoded[PIPELINE_FRAMES];
+	for (unsigned char*& bytes : quantised) bytes = frameMemory.AllocateArray<unsigned char>(width * height * 3);
+	std::vector<int> encodeTasks(frameCount), writeTasks(frameCount);
+	int lastRendered = -1, lastQuantised = -1;
+	TaskGraph graph;
+	
+	for (int frame = 0; frame < frameCount; frame++)
 	{
-
-		//construct the dynamic sphere
-		Sphere* sphere4 = new (spherePool) Sphere(Vec3f(0.0, 0, -20), r / 100, Vec3f(1.00, 0.32, 0.36), 1, 0.5);
-
-
-
-
-		//create a couple threads based on concurrency value
-
+		float r = (float)frame;
+		int buffer = frame % PIPELINE_FRAMES;
+
+		//construct the dynamic sphere, the one of the last frame is released first
+		int update = graph.Add([&, r]() {
+			spherePool->Release(dynamicSphere);
+			dynamicSphere = spherePool->GetHandle(new (spherePool) Sphere(Vec3f(0.0, 0, -20), r / 100, Vec3f(1.00, 0.32, 0.36), 1, 0.5));
+			dynamicIndex = dynamicSphere.index;
+		});
+		int refit = graph.Add([&]() {
+			scene.Update(*spherePool, dynamicIndex);
+			buildCount = scene.GetBVH().GetRebuildCount();
+			int dynamicSlot = scene.GetSlot(dynamicIndex);
+			changes.all = !dependencies.IsValid(buildCount);
+			changes.slots.assign(1, dynamicSlot);
+			changes.mask = SphereBit(dynamicSlot);
+			totalRetracedPixels = 0;
+			tiles.Reset(width, height);
+		});
+		graph.Precede(lastRendered, update);
+		graph.Precede(update, refit);
+
+		//the bands of the frame
+		int rendered = graph.Add([&, frame]() {
+			tiles.EndFrame();
+			switch (SMOOTH_SCALING_RENDERER) {
+			case BandRenderer::StaticCache: staticHits.Validate(scene.GetStaticBuildCount()); break;
+			case BandRenderer::Incremental: dependencies.Validate(buildCount); break;
+			default: break;
+			}
+			retracedPixels[frame] = totalRetracedPixels;
+			if (tiles.TilesRendered() > 0) tiles.Report(std::cout);
+		});
 		for (int i = 0; i < concurrency; i++) {
-			*threadList[i] = std::thread(threadedRender, spherePool->objects, image, &data, concurrency, i, width, height);
-		}
-		for (int i = 0; i < concurrency; i++)
-		{
-			threadList[i]->join();
+			std::function<void()> renderBand;
+			switch (SMOOTH_SCALING_RENDERER) {
+			case BandRenderer::Threaded: renderBand = std::bind(threadedRender, std::cref(scene), image, concurrency, i, width, height); break;
+			case BandRenderer::Tiles: renderBand = std::bind(tileRender, std::cref(scene), &tiles, image, i, width, height); break;
+			case BandRenderer::Wavefront: renderBand = std::bind(wavefrontRender, std::cref(scene), image, concurrency, i, width, height); break;
+			case BandRenderer::StaticCache: renderBand = std::bind(staticCacheRender, std::cref(scene), &staticHits, image, concurrency, i, width, height); break;
+			case BandRenderer::Incremental: renderBand = std::bind(incrementalRender, std::cref(scene), &dependencies, &changes, image, concurrency, i, width, height); break;
+			}
+			unsigned startRow, endRow;
+			BandRows(height, concurrency, i, startRow, endRow);
+			unsigned long long bandPixels = (unsigned long long)(endRow - startRow) * width;
+			int render = graph.Add([&, renderBand, bandPixels]() {
+				auto bandStart = std::chrono::steady_clock::now();
+				renderBand();
+				auto bandMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bandStart).count();
+				nodeCounters.Add(CurrentNumaNode(), bandPixels, bandMicroseconds);
+			}, i);
+			graph.Precede(refit, render);
+			graph.Precede(lastQuantised, render);
+			graph.Precede(render, rendered);
 		}
 
-
 		//create the file here
-		FileCreation(width, height, image, r);
-
-		std::cout << "Rendered and saved spheres" << r << ".ppm" << std::endl;
+		int quantisedAll = graph.Add([]() {});
+		for (int i = 0; i < concurrency; i++) {
+			int quantise = graph.Add([&, buffer, i]() {
+				QuantiseRows(image, quantised[buffer], width, height * i / concurrency, height * (i + 1) / concurrency);
+			}, i);
+			graph.Precede(rendered, quantise);
+			graph.Precede(frame >= PIPELINE_FRAMES ? encodeTasks[frame - PIPELINE_FRAMES] : -1, quantise);
+			graph.Precede(quantise, quantisedAll);
+		}
+		encodeTasks[frame] = graph.Add([&, buffer]() {
+			EncodePPM(quantised[buffer], width, height, encoded[buffer]);
+		});
+		graph.Precede(quantisedAll, encodeTasks[frame]);
+		graph.Precede(frame >= PIPELINE_FRAMES ? writeTasks[frame - PIPELINE_FRAMES] : -1, encodeTasks[frame]);
+		writeTasks[frame] = graph.Add([&, buffer, frame]() {
+			WriteFile(encoded[buffer], frame);
+			std::cout << "Rendered and saved spheres" << frame << ".ppm, traced " << retracedPixels[frame] << " of " << width * height << " pixels." << std::endl;
+		});
+		graph.Precede(encodeTasks[frame], writeTasks[frame]);
+		graph.Precede(frame > 0 ? writeTasks[frame - 1] : -1, writeTasks[frame]);
+
+		lastRendered = rendered;
+		lastQuantised = quantisedAll;
+	}
+	graph.Run(pool);
 
+	// Release the dynamic sphere
+	spherePool->Release(dynamicSphere);
 
 
-		// Release the dynamic sphere
-		spherePool->ReleaseLast();
+	std::cout << "BVH refitted " << scene.GetBVH().GetRefitCount() << " times, rebuilt " << scene.GetBVH().GetRebuildCount() << " times." << std::endl;
+	std::cout << "Adaptive termination culled " << totalCulledRays << " of " << totalTracedRays + totalCulledRays << " secondary rays." << std::endl;
+	for (int node = 0; node < MAX_NUMA_NODES; ++node) {
+		if (nodeCounters.microseconds[node] == 0) continue;
+		std::cout << "NUMA node " << node << ": " << (double)nodeCounters.pixels[node] / nodeCounters.microseconds[node] << " Mpixels/s over " << nodeCounters.pixels[node] << " band pixels." << std::endl;
 	}
 
-
 #ifdef _DEBUG
 
 	std::cout << std::endl;
 	HeapManager::GetHeapByIndex((int)HeapID::Graphics)->WalkTheHeap();
 #endif // DEBUG
 
-	delete [] image;
+	std::cout << "Frame memory: " << frameMemory.Peak() / 1024 << " of " << frameMemory.Capacity() / 1024 << " KiB used"
+		<< (frameMemory.GetPageKind() == PageKind::Huge ? ", huge pages" : frameMemory.GetPageKind() == PageKind::Transparent ? ", transparent huge pages" : "")
+		<< (frameMemory.IsLocked() ? ", locked." : ".") << std::endl;
+
+	frameMemory.Terminate();
 	//release all the spheres and delete the memory pool. this calls the destructor, releasing all the objects within it.
 	delete spherePool;
 
 }
-void SmoothScalingOriginal()
+//[comment]
+// Whole frames are rendered concurrently when a frame has fewer than this many pixels per worker.
+// The tiles of such a frame are finished so quickly that the join at the end of every frame, the
+// single threaded file write and the workers waiting on the last tile cost more than the tracing.
+//[/comment]
+#define FRAME_PARALLEL_PIXELS_PER_WORKER (256 * 256)
+//upper bound for the framebuffers of the frames in flight together
+#define FRAME_PARALLEL_MEMORY_BUDGET (256 << 20)
+
+bool UseFrameParallelism(unsigned width, unsigned height, int workers)
+{
+	return workers > 1 && (unsigned long long)width * height < (unsigned long long)workers * FRAME_PARALLEL_PIXELS_PER_WORKER;
+}
+
+//a frame in flight: its own copy of the spheres, the scene compiled from them and its framebuffer
+struct FrameSlot
 {
 	std::vector<Sphere> spheres;
+	std::vector<Sphere*> objects;
+	CompiledScene scene;
+	Vec3f* image;
+	int frame;
+};
+
+//[comment]
+// SmoothScaling without the incremental renderer, as a sequence of independent frames. Depending on
+// UseFrameParallelism the frames either run one after another with their tiles spread over the
+// pool, or every frame is a single job that compiles, renders and writes it, several of them in
+// flight at once. The number of frames in flight is capped by the worker count and by
+// FRAME_PARALLEL_MEMORY_BUDGET, and a new frame only starts once a slot has been freed.
+//[/comment]
+void SmoothScalingParallelFrames(ThreadPool& pool, unsigned width, unsigned height)
+{
+	int workers = pool.Size();
+	bool frameParallel = UseFrameParallelism(width, height, workers);
+	size_t frameBytes = sizeof(Vec3f) * width * height;
+	int maxInFlight = frameParallel ? (int)std::max<size_t>(1, std::min<size_t>(workers, FRAME_PARALLEL_MEMORY_BUDGET / frameBytes)) : 1;
+	std::cout << width << "x" << height << " on " << workers << " workers: " <<
+		(frameParallel ? "frame" : "tile") << " parallel, " << maxInFlight << " frame(s) in flight." << std::endl;
+
+	std::vector<FrameSlot> slots(maxInFlight);
+	std::vector<int> freeSlots;
+	for (int i = 0; i < maxInFlight; i++) {
+		slots[i].image = (Vec3f*)AllocatePages(width * height * sizeof(Vec3f), FRAMEBUFFER_PAGE_POLICY);
+		freeSlots.push_back(i);
+	}
+	std::mutex slotMutex;
+	std::condition_variable slotFreed;
+	TileScheduler tiles(workers);
+
+	for (int r = 0; r <= 100; r++)
+	{
+		int slotIndex;
+		{
+			std::unique_lock<std::mutex> lock(slotMutex);
+			slotFreed.wait(lock, [&] { return !freeSlots.empty(); });
+			slotIndex = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		FrameSlot& slot = slots[slotIndex];
+		slot.frame = r;
+		slot.spheres.clear();
+		slot.spheres.push_back(Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0, 0.0));
+		slot.spheres.push_back(Sphere(Vec3f(5.0, -1, -15), 2, Vec3f(0.90, 0.76, 0.46), 1, 0.0));
+		slot.spheres.push_back(Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0));
+		slot.spheres.push_back(Sphere(Vec3f(0.0, 0, -20), r / 100.0f, Vec3f(1.00, 0.32, 0.36), 1, 0.5));
+		slot.objects = SpherePointers(slot.spheres);
+
+		if (frameParallel) {
+			pool.Submit([&, slotIndex]() {
+				FrameSlot& slot = slots[slotIndex];
+				slot.scene.Compile(slot.objects);
+				PendingRay stack[TRACE_STACK_SIZE];
+				renderRegion(slot.scene, slot.image, 0, 0, width, height, width, height, stack);
+				FlushRayCounters();
+				FileCreation(width, height, slot.image, slot.frame);
+				{
+					std::lock_guard<std::mutex> lock(slotMutex);
+					std::cout << "Rendered and saved spheres" << slot.frame << ".ppm" << std::endl;
+					freeSlots.push_back(slotIndex);
+				}
+				slotFreed.notify_one();
+			});
+		}
+		else {
+			slot.scene.Compile(slot.objects);
+			tiles.Reset(width, height);
+			for (int i = 0; i < workers; i++) {
+				pool.Submit(std::bind(tileRender, std::cref(slot.scene), &tiles, slot.image, i, width, height));
+			}
+			pool.Wait();
+			tiles.EndFrame();
+			FileCreation(width, height, slot.image, r);
+			std::cout << "Rendered and saved spheres" << r << ".ppm" << std::endl;
+			freeSlots.push_back(slotIndex);
+		}
+	}
+	pool.Wait();
+
+	for (FrameSlot& slot : slots) FreePages(slot.image);
+}
+
+//[comment]
+// Look-dev loop: the SmoothScaling scene rendered over and over with only the colour and
+// transparency of the red sphere tweaked. No sphere moves, so after the first frame every frame
+// shades straight from the G-buffer.
+//[/comment]
+void MaterialTweaking(ThreadPool& pool)
+{
+	MemoryPool<Sphere>* spherePool = new MemoryPool<Sphere>(4);
+	new (spherePool) Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0, 0.0);
+	new (spherePool) Sphere(Vec3f(5.0, -1, -15), 2, Vec3f(0.90, 0.76, 0.46), 1, 0.0);
+	new (spherePool) Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0);
+	Sphere* tweaked = new (spherePool) Sphere(Vec3f(0.0, 0, -20), 4, Vec3f(1.00, 0.32, 0.36), 1, 0.5);
+	int tweakedIndex = spherePool->IndexOf(tweaked);
+
+	unsigned width = 1920, height = 1080;
+	int concurrency = pool.Size();
+	Vec3f* image = (Vec3f*)AllocatePages(width * height * sizeof(Vec3f), FRAMEBUFFER_PAGE_POLICY);
+	CompiledScene scene;
+	scene.Compile(*spherePool);
+	GBuffer gbuffer;
+	gbuffer.Resize(width, height);
+
+	for (int i = 0; i < 10; i++)
+	{
+		tweaked->surfaceColor = Vec3f(1.00, 0.32 + i * 0.05f, 0.36);
+		tweaked->transparency = 0.5f - i * 0.05f;
+		scene.Update(*spherePool, tweakedIndex);
+		bool reused = gbuffer.IsValid(scene.GetGeometryVersion());
+
+		for (int t = 0; t < concurrency; t++) {
+			pool.Submit(std::bind(gbufferRender, std::cref(scene), &gbuffer, image, concurrency, t, width, height));
+		}
+		pool.Wait();
+		gbuffer.Validate(scene.GetGeometryVersion());
+
+		FileCreation(width, height, image, i);
+		std::cout << "Rendered and saved spheres" << i << ".ppm" << (reused ? " from the G-buffer." : ", recorded the G-buffer.") << std::endl;
+	}
+
+	FreePages(image);
+	delete spherePool;
+}
+void SmoothScalingOriginal(ThreadPool& pool)
+{
+	std::vector<Sphere> spheres;
+	CompiledScene scene;
+	TileScheduler tiles(pool.Size()); //kept across the frames, see render
 	// Vector structure for Sphere (position, radius, surface color, reflectivity, transparency, emission color)
 	for (float r = 0; r <= 100; r++)
 	{
@@ -519,7 +1754,8 @@ void SmoothScalingOriginal()
 		spheres.push_back(Sphere(Vec3f(0.0, 0, -20), r / 100, Vec3f(1.00, 0.32, 0.36), 1, 0.5)); // Radius++ change here
 		spheres.push_back(Sphere(Vec3f(5.0, -1, -15), 2, Vec3f(0.90, 0.76, 0.46), 1, 0.0));
 		spheres.push_back(Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0));
-		render(spheres, r);
+		scene.Compile(SpherePointers(spheres));
+		render(scene, r, pool, tiles);
 		auto finish = std::chrono::steady_clock::now();
 		double elapsedSeconds = std::chrono::duration_cast<std::chrono::duration<double>>(finish - start).count();
 		std::cout << "Rendered and saved spheres" << r << ".ppm" << ". It took " << elapsedSeconds << "s to render and save." << std::endl;
@@ -527,6 +1763,157 @@ void SmoothScalingOriginal()
 		spheres.clear();
 	}
 }
+//[comment]
+// Renders one 1080p frame of the SmoothScaling scene on the calling thread with the recursive
+// trace, the iterative one and the material-specialised one, and prints the timings and how many
+// pixels of the other two differ from the recursive trace once quantized to 8 bits.
+// glassGrid > 0 puts a glassGrid x glassGrid wall of glass spheres (reflective and transparent)
+// between the camera and the scene, so most pixels get a full ray tree down to MAX_RAY_DEPTH.
+// Build with -DMAX_RAY_DEPTH=n to compare deeper trees, and with -DRAY_CONTRIBUTION_EPSILON=0 to
+// time the kernels on the same rays (the iterative trace culls weak rays, the recursive one can't).
+//[/comment]
+void TraceComparison(int glassGrid = 0)
+{
+	MemoryPool<Sphere>* spherePool = new MemoryPool<Sphere>(4 + glassGrid * glassGrid);
+	new (spherePool) Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0, 0.0);
+	new (spherePool) Sphere(Vec3f(5.0, -1, -15), 2, Vec3f(0.90, 0.76, 0.46), 1, 0.0);
+	new (spherePool) Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0);
+	new (spherePool) Sphere(Vec3f(0.0, 0, -20), 1, Vec3f(1.00, 0.32, 0.36), 1, 0.5);
+	for (int i = 0; i < glassGrid * glassGrid; ++i) {
+		float spacing = 8.0f / glassGrid;
+		Vec3f center((i % glassGrid - (glassGrid - 1) * 0.5f) * spacing, (i / glassGrid - (glassGrid - 1) * 0.5f) * spacing * 0.6f, -10);
+		new (spherePool) Sphere(center, spacing * 0.45f, Vec3f(0.95, 0.95, 0.95), 1, 0.9f);
+	}
+	CompiledScene scene;
+	scene.Compile(*spherePool);
+	std::cout << "Material classes: " << scene.GetClassSlots(MATERIAL_DIFFUSE).size() << " diffuse, "
+		<< scene.GetClassSlots(MATERIAL_REFLECTIVE).size() << " reflective, "
+		<< scene.GetClassSlots(MATERIAL_REFRACTIVE).size() << " refractive, "
+		<< scene.GetClassSlots(MATERIAL_GLASS).size() << " glass." << std::endl;
+
+	const int kernelCount = 3;
+	const char* kernelNames[kernelCount] = { "Recursive", "Iterative", "Specialised" };
+	unsigned width = 1920, height = 1080;
+	Vec3f* images[kernelCount];
+	for (int k = 0; k < kernelCount; ++k) images[k] = new Vec3f[width * height];
+	Camera camera(width, height);
+	Vec3f zero = Vec3f(0);
+	PendingRay stack[TRACE_STACK_SIZE];
+
+	//the kernels take turns and the fastest of a few runs is kept, so none of them is measured
+	//only on a cold cache or while the clock is still ramping up
+	double elapsedSeconds[kernelCount] = { 1e30, 1e30, 1e30 };
+	for (int run = 0; run < 5 * kernelCount; ++run) {
+		int pass = run % kernelCount;
+		Vec3f* pixel = images[pass];
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned y = 0; y < height; ++y) {
+			for (unsigned x = 0; x < width; ++x, ++pixel) {
+				Vec3f raydir = camera.Direction(x, y);
+				if (pass == 0) *pixel = traceRecursive(zero, raydir, scene, 0);
+				else if (pass == 1) *pixel = trace(zero, raydir, scene, stack);
+				else *pixel = traceSpecialised<0>(zero, raydir, scene);
+			}
+		}
+		auto finish = std::chrono::steady_clock::now();
+		elapsedSeconds[pass] = std::min(elapsedSeconds[pass], std::chrono::duration_cast<std::chrono::duration<double>>(finish - start).count());
+	}
+
+	std::cout << kernelNames[0] << " trace took " << elapsedSeconds[0] << "s." << std::endl;
+	for (int k = 1; k < kernelCount; ++k) {
+		int differentPixels = 0, largestDifference = 0;
+		for (unsigned i = 0; i < width * height; ++i) {
+			Vec3f& a = images[0][i];
+			Vec3f& b = images[k][i];
+			auto quantised = [](float channel) { return (int)(unsigned char)(std::min(float(1), channel) * 255); };
+			int difference = std::max(std::abs(quantised(a.x) - quantised(b.x)),
+				std::max(std::abs(quantised(a.y) - quantised(b.y)), std::abs(quantised(a.z) - quantised(b.z))));
+			if (difference > 0) differentPixels++;
+			largestDifference = std::max(largestDifference, difference);
+		}
+		std::cout << kernelNames[k] << " trace took " << elapsedSeconds[k] << "s (" << elapsedSeconds[0] / elapsedSeconds[k]
+			<< "x the recursive one). " << differentPixels << " pixels differ in the 8 bit output, by at most "
+			<< largestDifference << "/255." << std::endl;
+	}
+
+	for (int k = 0; k < kernelCount; ++k) delete[] images[k];
+	delete spherePool;
+}
+
+//[comment]
+// Renders the SmoothScaling scene at 1080p and 4K into framebuffers with normal and with huge pages
+// and quantises them the way FileCreation does, then prints the fastest of a few runs and the data
+// TLB misses of the pool's workers during it for every combination. Every run allocates its buffers
+// like render() does, so the page faults of first touching them are part of the time.
+//[/comment]
+void PagePolicyBenchmark(ThreadPool& pool)
+{
+	MemoryPool<Sphere>* spherePool = new MemoryPool<Sphere>(4);
+	new (spherePool) Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0, 0.0);
+	new (spherePool) Sphere(Vec3f(5.0, -1, -15), 2, Vec3f(0.90, 0.76, 0.46), 1, 0.0);
+	new (spherePool) Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0);
+	new (spherePool) Sphere(Vec3f(0.0, 0, -20), 1, Vec3f(1.00, 0.32, 0.36), 1, 0.5);
+	CompiledScene scene;
+	scene.Compile(*spherePool);
+
+	//one counter on every worker, the renderer and the quantiser only run there
+	int concurrency = pool.Size();
+	std::vector<std::unique_ptr<TlbMissCounter>> counters(concurrency);
+	for (int i = 0; i < concurrency; i++) pool.SubmitTo(i, [&, i]() { counters[i].reset(new TlbMissCounter()); });
+	pool.Wait();
+	bool countersAvailable = counters[0]->IsAvailable();
+	auto tlbMisses = [&]() {
+		unsigned long long misses = 0;
+		for (std::unique_ptr<TlbMissCounter>& counter : counters) misses += counter->Read();
+		return misses;
+	};
+
+	const unsigned resolutions[2][2] = { { 1920, 1080 }, { 3840, 2160 } };
+	const PagePolicy policies[2] = { PagePolicy::Normal, PagePolicy::HugePages };
+	const char* policyNames[2] = { "normal pages", "huge pages" };
+	const char* kindNames[3] = { "normal", "transparent huge", "hugetlbfs" };
+	for (const unsigned* resolution : resolutions) {
+		unsigned width = resolution[0], height = resolution[1];
+		for (int p = 0; p < 2; ++p) {
+			double bestSeconds = 1e30;
+			unsigned long long bestMisses = 0;
+			PageKind kind = PageKind::Normal;
+			for (int run = 0; run < 3; ++run) {
+				unsigned long long missesBefore = tlbMisses();
+				auto start = std::chrono::steady_clock::now();
+				Vec3f* image = (Vec3f*)AllocatePages(width * height * sizeof(Vec3f), policies[p]);
+				unsigned char* bytes = (unsigned char*)AllocatePages(width * height * 3, policies[p]);
+				for (int i = 0; i < concurrency; i++) {
+					pool.Submit(std::bind(threadedRender, std::cref(scene), image, concurrency, i, width, height));
+				}
+				pool.Wait();
+				for (int i = 0; i < concurrency; i++) {
+					pool.SubmitTo(i, [=]() { QuantiseRows(image, bytes, width, height * i / concurrency, height * (i + 1) / concurrency); });
+				}
+				pool.Wait();
+				kind = GetPageKind(image);
+				FreePages(bytes);
+				FreePages(image);
+				double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+				if (seconds < bestSeconds) {
+					bestSeconds = seconds;
+					bestMisses = tlbMisses() - missesBefore;
+				}
+			}
+			std::cout << width << "x" << height << ", " << policyNames[p] << " (got " << kindNames[(int)kind] << "): " << bestSeconds << "s, ";
+			if (countersAvailable) std::cout << bestMisses << " dTLB load misses." << std::endl;
+			else std::cout << "dTLB misses not available." << std::endl;
+		}
+	}
+	delete spherePool;
+}
+
+//[comment]
+// 1 pins every pool worker to its own core, so on a multi-socket machine a worker and the
+// framebuffer rows it touched first stay on the same NUMA node. 0 lets the OS move the workers.
+//[/comment]
+#define PIN_RENDER_WORKERS 0
+
 //[comment]
 // In the main function, we will create the scene which is composed of 5 spheres
 // and 1 light (which is also a sphere). Then, once the scene description is complete
@@ -539,10 +1926,19 @@ int main(int argc, char** argv)
 
 	// This sample only allows one choice per program execution. Feel free to improve upon this
 	srand(13);
-	//BasicRender();
-	//SimpleShrinking();
-	SmoothScaling();
-	//SmoothScalingOriginal();
+	{
+		//one set of render threads for the whole run, every render path hands its bands to it.
+		//it is gone again before the debug heaps are cleaned up
+		ThreadPool pool(ThreadPool::DefaultSize(), PIN_RENDER_WORKERS != 0);
+		//BasicRender(pool);
+		//SimpleShrinking(pool);
+		SmoothScaling(pool);
+		//MaterialTweaking(pool);
+		//SmoothScalingParallelFrames(pool, 640, 480);
+		//SmoothScalingOriginal(pool);
+		//TraceComparison();
+		//PagePolicyBenchmark(pool);
+	}
 
 	auto finish = std::chrono::steady_clock::now();
 	double elapsedSeconds = std::chrono::duration_cast<std::chrono::duration<double>>(finish - start).count();
@@ -0,0 +1,98 @@
+#pragma once
+#include <vector>
+#include "Sphere.h"
+
+//position and size of a sphere, all the intersection tests need
+struct SphereGeometry
+{
+	Vec3f center;
+	float radius2;
+
+	//same tests as Sphere::intersect and Sphere::occluded
+	bool intersect(const Vec3f& rayorig, const Vec3f& raydir, float& t0, float& t1) const
+	{
+		Vec3f l = center - rayorig;
+		float tca = l.dot(raydir);
+		if (tca < 0) return false;
+		float d2 = l.dot(l) - tca * tca;
+		if (d2 > radius2) return false;
+		float thc = sqrt(radius2 - d2);
+		t0 = tca - thc;
+		t1 = tca + thc;
+		return true;
+	}
+	bool occluded(const Vec3f& rayorig, const Vec3f& raydir, const float& tmax) const
+	{
+		Vec3f l = center - rayorig;
+		float tca = l.dot(raydir);
+		if (tca < 0) return false;
+		float d2 = l.dot(l) - tca * tca;
+		if (d2 > radius2) return false;
+		float beyond = tca - tmax;
+		return beyond < 0 || beyond * beyond < radius2 - d2;
+	}
+};
+
+//surface properties of a sphere, only looked up once a hit has been found
+struct Material
+{
+	Vec3f surfaceColor, emissionColor;
+	float transparency, reflection;
+};
+
+//an emissive sphere, gathered once per frame so the diffuse shading loop doesn't rescan the scene
+struct Light
+{
+	Vec3f center, emissionColor;
+	int index; //index of the light in geometry, its own shadow rays never count it as a blocker
+};
+
+//[comment]
+// Immutable render scene, compiled once per frame on the main thread before the render threads
+// start and then only read through a const reference. The geometry is one contiguous array that
+// the intersection loops stream through, the materials sit in a separate table with the same
+// index, and the lights are listed up front. noLights lets the diffuse shading skip its loop.
+//[/comment]
+class CompiledScene
+{
+public:
+	std::vector<SphereGeometry> geometry;
+	std::vector<Material> materials;
+	std::vector<Light> lights;
+	bool noLights;
+
+	CompiledScene() : noLights(true) {}
+
+	//copies the spheres out of the pool, empty slots are skipped. The vectors keep their capacity,
+	//so compiling the same scene every frame doesn't allocate.
+	void Compile(const std::vector<Sphere*>& objects)
+	{
+		geometry.clear();
+		materials.clear();
+		lights.clear();
+		for (unsigned i = 0; i < objects.size(); ++i) {
+			const Sphere* sphere = objects[i];
+			if (sphere == nullptr) continue;
+			if (sphere->emissionColor.x > 0) {
+				Light light;
+				light.center = sphere->center;
+				light.emissionColor = sphere->emissionColor;
+				light.index = (int)geometry.size();
+				lights.push_back(light);
+			}
+			SphereGeometry g;
+			g.center = sphere->center;
+			g.radius2 = sphere->radius2;
+			geometry.push_back(g);
+			Material m;
+			m.surfaceColor = sphere->surfaceColor;
+			m.emissionColor = sphere->emissionColor;
+			m.transparency = sphere->transparency;
+			m.reflection = sphere->reflection;
+			materials.push_back(m);
+		}
+		noLights = lights.empty();
+	}
+
+	int count() const { return (int)geometry.size(); }
+};
@@ -36,9 +36,12 @@
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <functional>
 
 #include "MemoryDebugger.h"
 #include "MemoryPool.h"
+#include "CompiledScene.h"
+#include "LinearAllocator.h"
 
 #if defined __linux__ || defined __APPLE__
 // "Compiled for Linux
@@ -145,11 +148,12 @@ Vec3f trace(
 				// this is a light
 				Vec3f transmission = 1;
 				Vec3f lightDirection = spheres[i].center - phit;
+				float lightDistance = lightDirection.length(); //spheres behind the light don't cast a shadow
 				lightDirection.normalize();
 				for (unsigned j = 0; j < spheres.size(); ++j) {
 					if (i != j) {
-						float t0, t1;
-						if (spheres[j].intersect(phit + nhit * bias, lightDirection, t0, t1)) {
+						//optimization: any-hit test, no square root and no hit distances
+						if (spheres[j].occluded(phit + nhit * bias, lightDirection, lightDistance)) {
 							transmission = 0;
 							break;
 						}
@@ -166,35 +170,36 @@ Vec3f trace(
 Vec3f traceThreadless(
 	const Vec3f& rayorig,
 	const Vec3f& raydir,
-	const std::vector<Sphere*>& spheres,
+	const CompiledScene& scene,
 	const int& depth,
 	Vec3f& output)
 {
 	output = Vec3f(0);
 	//if (raydir.length() != 1) std::cerr << "Error " << raydir << std::endl;
 	float tnear = INFINITY;
-	const Sphere* sphere = NULL;
+	int hitIndex = -1;
 	// find intersection of this ray with the sphere in the scene
 
-	for (unsigned i = 0; i < spheres.size(); ++i) {
+	for (int i = 0; i < scene.count(); ++i) {
 		float t0 = INFINITY, t1 = INFINITY;
-		if (spheres[i]->intersect(rayorig, raydir, t0, t1)) {
+		if (scene.geometry[i].intersect(rayorig, raydir, t0, t1)) {
 			if (t0 < 0) t0 = t1;
 			if (t0 < tnear) {
 				tnear = t0;
-				sphere = spheres[i];
+				hitIndex = i;
 			}
 		}
 	}
 	// if there's no intersection return black or background color
-	if (!sphere) {
+	if (hitIndex < 0) {
 		output = Vec3f(2);
 		return output;
 	}
 
+	const Material& material = scene.materials[hitIndex];
 	Vec3f surfaceColor = 0; // color of the ray/surfaceof the object intersected by the ray
 	Vec3f phit = rayorig + raydir * tnear; // point of intersection
-	Vec3f nhit = phit - sphere->center; // normal at the intersection point
+	Vec3f nhit = phit - scene.geometry[hitIndex].center; // normal at the intersection point
 	nhit.normalize(); // normalize normal direction
 	// If the normal and the view direction are not opposite to each other
 	// reverse the normal direction. That also means we are inside the sphere so set
@@ -202,8 +207,8 @@ Vec3f traceThreadless(
 	// positive.
 	float bias = 1e-4; // add some bias to the point from which we will be tracing
 	bool inside = false;
-	bool transparent = sphere->transparency > 0;
-	bool reflective = sphere->reflection > 0;
+	bool transparent = material.transparency > 0;
+	bool reflective = material.reflection > 0;
 	if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true;
 	if ((transparent || reflective) && depth < MAX_RAY_DEPTH) {
 		float facingratio = -raydir.dot(nhit);
@@ -221,7 +226,7 @@ Vec3f traceThreadless(
 		if (reflective) {
 			Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
 			refldir.normalize();
-			traceThreadless(phit + nhit * bias, refldir, spheres, depth + 1, reflection);
+			traceThreadless(phit + nhit * bias, refldir, scene, depth + 1, reflection);
 			surfaceColor += reflection * fresneleffect;
 		}
 
@@ -233,66 +238,208 @@ Vec3f traceThreadless(
 			float k = 1 - eta * eta * (1 - cosi * cosi);
 			Vec3f refrdir = raydir * eta + nhit * (eta * cosi - sqrt(k));
 			refrdir.normalize();
-			traceThreadless(phit - nhit * bias, refrdir, spheres, depth + 1, refraction);
-			surfaceColor += refraction * (1 - fresneleffect) * sphere->transparency;
+			traceThreadless(phit - nhit * bias, refrdir, scene, depth + 1, refraction);
+			surfaceColor += refraction * (1 - fresneleffect) * material.transparency;
 		}
 
 		// the result is a mix of reflection and refraction (if the sphere is transparent)
-		surfaceColor *= sphere->surfaceColor;
+		surfaceColor *= material.surfaceColor;
 	}
 	else {
 		// it's a diffuse object, no need to raytrace any further
-		for (unsigned i = 0; i < spheres.size(); ++i) {
-			Sphere temp = *spheres[i];
-			if (temp.emissionColor.x > 0) {
-				// this is a light
+		//optimization: only the precomputed lights are visited, scenes without lights skip the loop
+		if (!scene.noLights) {
+			for (const Light& light : scene.lights) {
 				Vec3f transmission = 1;
-				Vec3f lightDirection = temp.center - phit;
+				Vec3f lightDirection = light.center - phit;
+				float lightDistance = lightDirection.length(); //spheres behind the light don't cast a shadow
 				lightDirection.normalize();
-				for (unsigned j = 0; j < spheres.size(); ++j) {
-					if (i != j) {
-						float t0, t1;
-						if (spheres[j]->intersect(phit + nhit * bias, lightDirection, t0, t1)) {
+				for (int j = 0; j < scene.count(); ++j) {
+					if (j != light.index) {
+						//optimization: any-hit test, no square root and no hit distances
+						if (scene.geometry[j].occluded(phit + nhit * bias, lightDirection, lightDistance)) {
 							transmission = 0;
 							break;
 						}
 					}
 				}
-				surfaceColor += sphere->surfaceColor * transmission *
-					std::max(float(0), nhit.dot(lightDirection)) * temp.emissionColor;
+				surfaceColor += material.surfaceColor * transmission *
+					std::max(float(0), nhit.dot(lightDirection)) * light.emissionColor;
 			}
 		}
 	}
-	output = surfaceColor + sphere->emissionColor;
+	output = surfaceColor + material.emissionColor;
 	return output;
 }
+
+//[comment]
+// Size of the explicit ray stack of traceIterative. A hit that spawns two rays keeps following
+// the first one and only pushes the second, so at most one ray per bounce level is ever waiting.
+//[/comment]
+#define TRACE_STACK_SIZE (MAX_RAY_DEPTH + 1)
+
+//[comment]
+// A ray of the iterative trace. weight is the product of the fresnel/transparency factors and
+// surface colours of every hit above it, so whatever the ray finds is added straight into the
+// pixel instead of being returned up a chain of calls.
+//[/comment]
+struct PendingRay
+{
+	Vec3f origin, direction, weight;
+	int depth;
+};
+
+//[comment]
+// Shades one hit of the iterative trace. The diffuse and emitted light is added to color scaled by
+// the ray weight. If the surface spawns secondary rays, ray is turned into the first of them and
+// true is returned, the refraction ray of a surface that also reflects is pushed on the stack.
+//[/comment]
+bool shadeHit(
+	PendingRay& ray,
+	const CompiledScene& scene,
+	const int hitIndex,
+	const float tnear,
+	Vec3f& color,
+	PendingRay* stack,
+	int& stackSize)
+{
+	const Material& material = scene.materials[hitIndex];
+	Vec3f phit = ray.origin + ray.direction * tnear; // point of intersection
+	Vec3f nhit = phit - scene.geometry[hitIndex].center; // normal at the intersection point
+	nhit.normalize(); // normalize normal direction
+	float bias = 1e-4; // add some bias to the point from which we will be tracing
+	bool inside = false;
+	if (ray.direction.dot(nhit) > 0) nhit = -nhit, inside = true;
+	bool transparent = material.transparency > 0;
+	bool reflective = material.reflection > 0;
+	color += ray.weight * material.emissionColor;
+	if ((transparent || reflective) && ray.depth < MAX_RAY_DEPTH) {
+		float facingratio = -ray.direction.dot(nhit);
+		// change the mix value to tweak the effect
+		float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
+		// the result is a mix of reflection and refraction, tinted by the surface color
+		Vec3f surfaceWeight = ray.weight * material.surfaceColor;
+		Vec3f raydir = ray.direction;
+		ray.depth++;
+
+		if (transparent) {
+			float ior = 1.1, eta = (inside) ? ior : 1 / ior; // are we inside or outside the surface?
+			float cosi = -nhit.dot(raydir);
+			float k = 1 - eta * eta * (1 - cosi * cosi);
+			PendingRay& refraction = reflective ? stack[stackSize++] : ray;
+			refraction.direction = raydir * eta + nhit * (eta * cosi - sqrt(k));
+			refraction.direction.normalize();
+			refraction.origin = phit - nhit * bias;
+			refraction.weight = surfaceWeight * ((1 - fresneleffect) * material.transparency);
+			refraction.depth = ray.depth;
+		}
+		if (reflective) {
+			ray.direction = raydir - nhit * 2 * raydir.dot(nhit);
+			ray.direction.normalize();
+			ray.origin = phit + nhit * bias;
+			ray.weight = surfaceWeight * fresneleffect;
+		}
+		return true;
+	}
+
+	// it's a diffuse object, no need to raytrace any further
+	//optimization: only the precomputed lights are visited, scenes without lights skip the loop
+	if (scene.noLights) return false;
+	for (const Light& light : scene.lights) {
+		Vec3f transmission = 1;
+		Vec3f lightDirection = light.center - phit;
+		float lightDistance = lightDirection.length(); //spheres behind the light don't cast a shadow
+		lightDirection.normalize();
+		for (int j = 0; j < scene.count(); ++j) {
+			if (j != light.index) {
+				//optimization: any-hit test, no square root and no hit distances
+				if (scene.geometry[j].occluded(phit + nhit * bias, lightDirection, lightDistance)) {
+					transmission = 0;
+					break;
+				}
+			}
+		}
+		color += ray.weight * material.surfaceColor * transmission *
+			std::max(float(0), nhit.dot(lightDirection)) * light.emissionColor;
+	}
+	return false;
+}
+
+//[comment]
+// Non-recursive version of traceThreadless. The ray keeps following its first child and the
+// second child of a surface that both reflects and refracts waits on a small fixed-size stack
+// with its accumulated weight. That is one stack frame per pixel instead of up to 63, and no
+// Vec3f temporaries have to travel back up the call chain.
+// stack has to hold TRACE_STACK_SIZE rays. It is owned by the caller and reused for every pixel,
+// since zeroing a fresh array of Vec3f per pixel costs about as much as the recursion it replaces.
+// The result matches traceThreadless up to float rounding (the sums are done in a different order).
+//[/comment]
+Vec3f traceIterative(
+	const Vec3f& rayorig,
+	const Vec3f& raydir,
+	const CompiledScene& scene,
+	PendingRay* stack)
+{
+	Vec3f color = 0;
+	int stackSize = 0;
+	PendingRay ray;
+	ray.origin = rayorig;
+	ray.direction = raydir;
+	ray.weight = Vec3f(1);
+	ray.depth = 0;
+	while (true) {
+		float tnear = INFINITY;
+		int hitIndex = -1;
+		// find intersection of this ray with the sphere in the scene
+		for (int i = 0; i < scene.count(); ++i) {
+			float t0 = INFINITY, t1 = INFINITY;
+			if (scene.geometry[i].intersect(ray.origin, ray.direction, t0, t1)) {
+				if (t0 < 0) t0 = t1;
+				if (t0 < tnear) {
+					tnear = t0;
+					hitIndex = i;
+				}
+			}
+		}
+		// if there's no intersection add the background color
+		bool follow = false;
+		if (hitIndex >= 0) follow = shadeHit(ray, scene, hitIndex, tnear, color, stack, stackSize);
+		else color += ray.weight * Vec3f(2);
+
+		if (!follow) {
+			if (stackSize == 0) return color;
+			ray = stack[--stackSize];
+		}
+	}
+}
 /////////////////////////////////////////////////////// my edit
 Vec3f trace(
 	const Vec3f& rayorig,
 	const Vec3f& raydir,
-	const std::vector<Sphere*>& spheres,
+	const CompiledScene& scene,
 	const int& depth)
 {
 	//if (raydir.length() != 1) std::cerr << "Error " << raydir << std::endl;
 	float tnear = INFINITY;
-	const Sphere* sphere = NULL;
+	int hitIndex = -1;
 	// find intersection of this ray with the sphere in the scene
 
-	for (unsigned i = 0; i < spheres.size(); ++i) {
+	for (int i = 0; i < scene.count(); ++i) {
 		float t0 = INFINITY, t1 = INFINITY;
-		if (spheres[i]->intersect(rayorig, raydir, t0, t1)) {
+		if (scene.geometry[i].intersect(rayorig, raydir, t0, t1)) {
 			if (t0 < 0) t0 = t1;
 			if (t0 < tnear) {
 				tnear = t0;
-				sphere = spheres[i];
+				hitIndex = i;
 			}
 		}
 	}
 	// if there's no intersection return black or background color
-	if (!sphere) return Vec3f(2);
+	if (hitIndex < 0) return Vec3f(2);
+	const Material& material = scene.materials[hitIndex];
 	Vec3f surfaceColor = 0; // color of the ray/surfaceof the object intersected by the ray
 	Vec3f phit = rayorig + raydir * tnear; // point of intersection
-	Vec3f nhit = phit - sphere->center; // normal at the intersection point
+	Vec3f nhit = phit - scene.geometry[hitIndex].center; // normal at the intersection point
 	nhit.normalize(); // normalize normal direction
 	// If the normal and the view direction are not opposite to each other
 	// reverse the normal direction. That also means we are inside the sphere so set
@@ -300,8 +447,8 @@ Vec3f trace(
 	// positive.
 	float bias = 1e-4; // add some bias to the point from which we will be tracing
 	bool inside = false;
-	bool transparent = sphere->transparency > 0;
-	bool reflective = sphere->reflection > 0;
+	bool transparent = material.transparency > 0;
+	bool reflective = material.reflection > 0;
 	if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true;
 	if ((transparent || reflective) && depth < MAX_RAY_DEPTH) {
 		float facingratio = -raydir.dot(nhit);
@@ -323,8 +470,8 @@ Vec3f trace(
 		if (reflective) {
 			Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
 			refldir.normalize();
-			//traceThreadless(phit + nhit * bias, refldir, spheres, depth + 1, reflection);
-			reflectionThread = std::thread(traceThreadless, phit + nhit * bias, refldir, spheres, depth + 1, reflection);
+			//traceThreadless(phit + nhit * bias, refldir, scene, depth + 1, reflection);
+			reflectionThread = std::thread(traceThreadless, phit + nhit * bias, refldir, std::cref(scene), depth + 1, reflection);
 		}
 
 
@@ -335,8 +482,8 @@ Vec3f trace(
 			float k = 1 - eta * eta * (1 - cosi * cosi);
 			Vec3f refrdir = raydir * eta + nhit * (eta * cosi - sqrt(k));
 			refrdir.normalize();
-			//traceThreadless(phit - nhit * bias, refrdir, spheres, depth + 1, reflection);
-			refractionThread = std::thread(traceThreadless, phit - nhit * bias, refrdir, spheres, depth + 1, refraction);
+			//traceThreadless(phit - nhit * bias, refrdir, scene, depth + 1, reflection);
+			refractionThread = std::thread(traceThreadless, phit - nhit * bias, refrdir, std::cref(scene), depth + 1, refraction);
 			
 		}
 
@@ -348,37 +495,37 @@ Vec3f trace(
 		if (refractionThread.joinable()) 
 		{
 			refractionThread.join();
-			surfaceColor += refraction * (1 - fresneleffect) * sphere->transparency;
+			surfaceColor += refraction * (1 - fresneleffect) * material.transparency;
 		}
 
 		// the result is a mix of reflection and refraction (if the sphere is transparent)
-		surfaceColor *= sphere->surfaceColor;
+		surfaceColor *= material.surfaceColor;
 	}
 	else {
 		// it's a diffuse object, no need to raytrace any further
-		for (unsigned i = 0; i < spheres.size(); ++i) {
-			Sphere temp = *spheres[i];
-			if (temp.emissionColor.x > 0) {
-				// this is a light
+		//optimization: only the precomputed lights are visited, scenes without lights skip the loop
+		if (!scene.noLights) {
+			for (const Light& light : scene.lights) {
 				Vec3f transmission = 1;
-				Vec3f lightDirection = temp.center - phit;
+				Vec3f lightDirection = light.center - phit;
+				float lightDistance = lightDirection.length(); //spheres behind the light don't cast a shadow
 				lightDirection.normalize();
-				for (unsigned j = 0; j < spheres.size(); ++j) {
-					if (i != j) {
-						float t0, t1;
-						if (spheres[j]->intersect(phit + nhit * bias, lightDirection, t0, t1)) {
+				for (int j = 0; j < scene.count(); ++j) {
+					if (j != light.index) {
+						//optimization: any-hit test, no square root and no hit distances
+						if (scene.geometry[j].occluded(phit + nhit * bias, lightDirection, lightDistance)) {
 							transmission = 0;
 							break;
 						}
 					}
 				}
-				surfaceColor += sphere->surfaceColor * transmission *
-					std::max(float(0), nhit.dot(lightDirection)) * temp.emissionColor;
+				surfaceColor += material.surfaceColor * transmission *
+					std::max(float(0), nhit.dot(lightDirection)) * light.emissionColor;
 			}
 		}
 	}
 
-	return surfaceColor + sphere->emissionColor;
+	return surfaceColor + material.emissionColor;
 }
 
 
@@ -387,17 +534,11 @@ Vec3f trace(
 // Main rendering function. We compute a camera ray for each pixel of the image
 // trace it and return a color. If the ray hits a sphere, we return the color of the
 // sphere at the intersection point, else we return the background color.
+// The colors go to the caller's image, FileCreation writes it out.
 //[/comment]
-void render(const std::vector<Sphere*>& spheres, int iteration)
+void render(const CompiledScene& scene, Vec3f* image, unsigned const width, unsigned const height)
 {
-
-
-	// Recommended Testing Resolution
-	//unsigned const width = 640, height = 480;
-
-	// Recommended Production Resolution
-	unsigned width = 1920, height = 1080;
-	Vec3f* image = new Vec3f[width * height], * pixel = image; //array of colors
+	Vec3f* pixel = image;
 	float invWidth = 2 / float(width), invHeight = 2 / float(height); //optimization: rather than multiplying by 2 on every iteration, just do it here once.
 	float fov = 30, aspectratio = width / float(height);
 	float angle = tan(M_PI * 0.5 * fov / 180.);
@@ -413,29 +554,12 @@ void render(const std::vector<Sphere*>& spheres, int iteration)
 			float yy = (1 - y * invHeight) * angle;
 			Vec3f raydir(xx, yy, -1);
 			raydir.normalize();
-			*pixel = trace(zero, raydir, spheres, 0);
+			*pixel = trace(zero, raydir, scene, 0);
 		}
 	}
-
-
-	// Save result to a PPM image (keep these flags if you compile under Windows)
-	std::stringstream ss;
-	ss << "./spheres" << iteration << ".ppm";
-	std::string tempString = ss.str();
-	char* filename = (char*)tempString.c_str();
-
-	std::ofstream ofs(filename, std::ios::out | std::ios::binary);
-	ofs << "P6\n" << width << " " << height << "\n255\n";
-	for (unsigned i = 0; i < width * height; ++i) {
-		ofs << (unsigned char)(std::min(float(1), image[i].x) * 255) <<
-			(unsigned char)(std::min(float(1), image[i].y) * 255) <<
-			(unsigned char)(std::min(float(1), image[i].z) * 255);
-	}
-	ofs.close();
-	delete[] image;
 }
 ////////////////////////////////////////////////////////////////////////// my edit
-void threadedRender(const std::vector<Sphere*>& spheres, Vec3f* pImage, std::mutex* data, const int maxSubdivisions, const int thisSubdivision, unsigned const width, unsigned const height)
+void threadedRender(const CompiledScene& scene, Vec3f* pImage, std::mutex* data, const int maxSubdivisions, const int thisSubdivision, unsigned const width, unsigned const height)
 {
 
 	Vec3f* pixel = pImage; //copy of pointer to be used for iteration
@@ -455,6 +579,7 @@ void threadedRender(const std::vector<Sphere*>& spheres, Vec3f* pImage, std::mut
 
 	// Trace rays
 	Vec3f zero = Vec3f(0);
+	PendingRay stack[TRACE_STACK_SIZE]; //ray stack of traceIterative, shared by every pixel of the band
 	for (unsigned y = startIndex; y < endIndex; ++y) {
 		for (unsigned x = 0; x < width; ++x, ++pixel) {
 			//optimization: removing "+0.5" from xx and yy didnt make a difference to the output image
@@ -462,9 +587,9 @@ void threadedRender(const std::vector<Sphere*>& spheres, Vec3f* pImage, std::mut
 			float yy = (1 - y * invHeight) * angle;
 			Vec3f raydir(xx, yy, -1);
  			raydir.normalize();
-			//Vec3f temp = trace(zero, raydir, spheres, 0);
-			Vec3f temp;
-			traceThreadless(zero, raydir, spheres, 0, temp);
+			//Vec3f temp = trace(zero, raydir, scene, 0);
+			//optimization: explicit-stack trace instead of the recursive traceThreadless
+			Vec3f temp = traceIterative(zero, raydir, scene, stack);
 			//the threads don't fight over this resource, the mutex is not actually needed!
 			//(*data).lock();
 			*pixel = temp;
@@ -473,8 +598,37 @@ void threadedRender(const std::vector<Sphere*>& spheres, Vec3f* pImage, std::mut
 	}
 
 }
-void FileCreation(unsigned const width, unsigned const height, Vec3f* image, int iteration)
+//[comment]
+// LinearAllocator flags of the frame memory, the framebuffer and the bytes FileCreation writes.
+// It is mapped once per run and rewound every frame, so every frame reuses the same pages.
+//[/comment]
+#define FRAME_MEMORY_FLAGS LINEAR_ALLOCATOR_HUGE_PAGES
+
+//maps frame memory for one width x height frame, with normal pages if FRAME_MEMORY_FLAGS can't be had. False if nothing could be mapped
+bool MapFrameMemory(LinearAllocator& frameMemory, unsigned const width, unsigned const height)
+{
+	size_t frameBytes = width * height * (sizeof(Vec3f) + 3) + 2 * 64;
+	if (frameMemory.Initialize(frameBytes, FRAME_MEMORY_FLAGS) || frameMemory.Initialize(frameBytes)) return true;
+	std::cout << "Could not map " << frameBytes / 1024 << " KiB of frame memory, nothing was rendered." << std::endl;
+	return false;
+}
+
+void FileCreation(unsigned const width, unsigned const height, Vec3f* image, int iteration, LinearAllocator& scratch)
 {
+	//optimization: the bytes are quantised into scratch frame memory and written with one call instead of one stream insertion per byte
+	LinearAllocator::Marker marker = scratch.GetMarker();
+	std::vector<unsigned char> heapBytes;
+	unsigned char* bytes = scratch.AllocateArray<unsigned char>(width * height * 3);
+	if (bytes == nullptr) { //the frame memory is full
+		heapBytes.resize(width * height * 3);
+		bytes = heapBytes.data();
+	}
+	for (unsigned i = 0; i < width * height; ++i) {
+		bytes[i * 3] = (unsigned char)(std::min(float(1), image[i].x) * 255);
+		bytes[i * 3 + 1] = (unsigned char)(std::min(float(1), image[i].y) * 255);
+		bytes[i * 3 + 2] = (unsigned char)(std::min(float(1), image[i].z) * 255);
+	}
+
 	// Save result to a PPM image (keep these flags if you compile under Windows)
 	std::stringstream ss;
 	ss << "./spheres" << iteration << ".ppm";
@@ -483,12 +637,9 @@ void FileCreation(unsigned const width, unsigned const height, Vec3f* image, int
 
 	std::ofstream ofs(filename, std::ios::out | std::ios::binary);
 	ofs << "P6\n" << width << " " << height << "\n255\n";
-	for (unsigned i = 0; i < width * height; ++i) {
-		ofs << (unsigned char)(std::min(float(1), image[i].x) * 255) <<
-			(unsigned char)(std::min(float(1), image[i].y) * 255) <<
-			(unsigned char)(std::min(float(1), image[i].z) * 255);
-	}
+	ofs.write((const char*)bytes, width * height * 3);
 	ofs.close();
+	scratch.Rewind(marker);
 }
 
 void BasicRender()
@@ -573,9 +724,17 @@ void SmoothScaling()
 
 	// Recommended Production Resolution
 	unsigned width = 1920, height = 1080;
+	//the framebuffer and the bytes of the file are mapped in one block for the whole run
+	LinearAllocator frameMemory;
+	if (!MapFrameMemory(frameMemory, width, height)) {
+		delete spherePool;
+		return;
+	}
 	//create the array of pixels and a mutex for it.
 	std::mutex data;
-	Vec3f* image = new Vec3f[width * height];
+	Vec3f* image = frameMemory.AllocateArray<Vec3f>(width * height);
+	//flat render scene (geometry, material table, lights), compiled once per frame before tracing starts
+	CompiledScene scene;
 
 	for (float r = 0; r <= 100; r++)
 	{
@@ -584,13 +743,14 @@ void SmoothScaling()
 		Sphere* sphere4 = new (spherePool) Sphere(Vec3f(0.0, 0, -20), r / 100, Vec3f(1.00, 0.32, 0.36), 1, 0.5);
 
 
-		render(spherePool->objects, r);
+		scene.Compile(spherePool->objects);
+		render(scene, image, width, height);
 
 		//create a couple threads based on concurrency value
 
 
 		//create the file here
-		FileCreation(width, height, image, r);
+		FileCreation(width, height, image, r, frameMemory);
 		auto finish = std::chrono::steady_clock::now();
 		double elapsedSeconds = std::chrono::duration_cast<std::chrono::duration<double>>(finish - start).count();
 		std::cout << "Rendered and saved spheres" << r << ".ppm" << ". It took " << elapsedSeconds << "s to render and save." << std::endl;
@@ -608,7 +768,7 @@ void SmoothScaling()
 	HeapManager::GetHeapByIndex((int)HeapID::Graphics)->WalkTheHeap();
 #endif // DEBUG
 
-	delete [] image;
+	frameMemory.Terminate();
 	//release all the spheres and delete the memory pool. this calls the destructor, releasing all the objects within it.
 	delete spherePool;
 
@@ -632,6 +792,71 @@ void SmoothScalingOriginal()
 		spheres.clear();
 	}
 }
+//[comment]
+// Renders one 1080p frame of the SmoothScaling scene on the calling thread with traceThreadless
+// and with traceIterative, and prints both timings and how many pixels differ once quantized
+// to 8 bits.
+//[/comment]
+void TraceComparison()
+{
+	MemoryPool<Sphere>* spherePool = new MemoryPool<Sphere>(4);
+	new (spherePool) Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0, 0.0);
+	new (spherePool) Sphere(Vec3f(5.0, -1, -15), 2, Vec3f(0.90, 0.76, 0.46), 1, 0.0);
+	new (spherePool) Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0);
+	new (spherePool) Sphere(Vec3f(0.0, 0, -20), 1, Vec3f(1.00, 0.32, 0.36), 1, 0.5);
+	const std::vector<Sphere*>& spheres = spherePool->objects;
+	CompiledScene scene;
+	scene.Compile(spheres);
+
+	unsigned width = 1920, height = 1080;
+	Vec3f* recursiveImage = new Vec3f[width * height];
+	Vec3f* iterativeImage = new Vec3f[width * height];
+	float invWidth = 2 / float(width), invHeight = 2 / float(height);
+	float fov = 30, aspectratio = width / float(height);
+	float angle = tan(M_PI * 0.5 * fov / 180.);
+	float angleAndAspect = angle * aspectratio;
+	Vec3f zero = Vec3f(0);
+	PendingRay stack[TRACE_STACK_SIZE];
+
+	//the two kernels take turns and the fastest of a few runs is kept, so neither one is measured
+	//only on a cold cache or while the clock is still ramping up
+	double elapsedSeconds[2] = { 1e30, 1e30 };
+	for (int run = 0; run < 10; ++run) {
+		int pass = run % 2;
+		Vec3f* pixel = pass == 0 ? recursiveImage : iterativeImage;
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned y = 0; y < height; ++y) {
+			for (unsigned x = 0; x < width; ++x, ++pixel) {
+				float xx = (x * invWidth - 1) * angleAndAspect;
+				float yy = (1 - y * invHeight) * angle;
+				Vec3f raydir(xx, yy, -1);
+				raydir.normalize();
+				if (pass == 0) traceThreadless(zero, raydir, scene, 0, *pixel);
+				else *pixel = traceIterative(zero, raydir, scene, stack);
+			}
+		}
+		auto finish = std::chrono::steady_clock::now();
+		elapsedSeconds[pass] = std::min(elapsedSeconds[pass], std::chrono::duration_cast<std::chrono::duration<double>>(finish - start).count());
+	}
+
+	int differentPixels = 0;
+	for (unsigned i = 0; i < width * height; ++i) {
+		Vec3f& a = recursiveImage[i];
+		Vec3f& b = iterativeImage[i];
+		if ((unsigned char)(std::min(float(1), a.x) * 255) != (unsigned char)(std::min(float(1), b.x) * 255) ||
+			(unsigned char)(std::min(float(1), a.y) * 255) != (unsigned char)(std::min(float(1), b.y) * 255) ||
+			(unsigned char)(std::min(float(1), a.z) * 255) != (unsigned char)(std::min(float(1), b.z) * 255)) {
+			differentPixels++;
+		}
+	}
+	std::cout << "Recursive trace took " << elapsedSeconds[0] << "s, iterative trace took " << elapsedSeconds[1] << "s ("
+		<< elapsedSeconds[0] / elapsedSeconds[1] << "x). " << differentPixels << " pixels differ in the 8 bit output." << std::endl;
+
+	delete[] recursiveImage;
+	delete[] iterativeImage;
+	delete spherePool;
+}
+
 //[comment]
 // In the main function, we will create the scene which is composed of 5 spheres
 // and 1 light (which is also a sphere). Then, once the scene description is complete
@@ -648,6 +873,7 @@ int main(int argc, char** argv)
 	//SimpleShrinking();
 	SmoothScaling();
 	//SmoothScalingOriginal();
+	//TraceComparison();
 
 	auto finish = std::chrono::steady_clock::now();
 	double elapsedSeconds = std::chrono::duration_cast<std::chrono::duration<double>>(finish - start).count();